@@ -1,26 +1,12 @@
 #include "helpers.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-/**
- * @brief Returns the ciphertext location for the serialization
- * 
- * @param num 
- * @return string 
- */
-string ciphertextName(int num) {
-  string name = "/ciphertexts/ciphertext" + to_string(num) + ".txt";
-  return name;
-}
-
-/**
- * @brief Returns the aggregator file location for the serialization
- * 
- * @param num 
- * @return string 
- */
-string aggregatorFileName(int num) {
-  string name = "/file" + to_string(num) + ".txt";
-  return name;
-}
+// Number of symbols reconstructed together by the CRT decoders
+const size_t CRTBLOCK = 512;
 
 /**
  * @brief Helper function to print the vector passed as parameter
@@ -68,6 +54,43 @@ vector<int> RNSBase (int low, int high) {
   return m;
 }
 
+/**
+ * @brief It returns the base for symbols of width bytes: the smallest primes
+ * whose product covers 2^(8 * width) are the legitimate moduli, followed by
+ * the next redundant primes
+ * 
+ * @param width 
+ * @param redundant 
+ * @return vector<int> 
+ */
+vector<int> RNSSymbolBase (int width, size_t redundant) {
+  vector<int> primes = RNSBase(0, 256);
+  vector<int> m;
+  double range = 1;
+
+  while (range < ldexp(1.0, 8 * width)) {
+    range *= primes[m.size()];
+    m.push_back(primes[m.size()]);
+  }
+
+  for (size_t i = 0; i < redundant; i++) {
+    m.push_back(primes[m.size()]);
+  }
+  return m;
+}
+
+/**
+ * @brief Number of symbols of width bytes needed for len bytes, 
+ * the last one being zero padded
+ * 
+ * @param len 
+ * @param width 
+ * @return size_t 
+ */
+size_t RNSSymbols (size_t len, int width) {
+  return (len + width - 1) / width;
+}
+
 /**
  * @brief Given a number and the moduli base, it returns the vector of remainders
  * 
@@ -116,20 +139,2204 @@ int inv(int a, int m) {
  
     return x1;
 }
+
+/**
+ * @brief 64-bit FNV-1a hash; it can be chained over several buffers 
+ * passing the previous hash
+ * 
+ * @param data 
+ * @param len 
+ * @param hash 
+ * @return uint64_t 
+ */
+uint64_t FNV1a (const uint8_t *data, size_t len, uint64_t hash) {
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
  
-int CRT(vector<int> base, vector<int> rem) {
+/**
+ * @brief It precomputes the CRT constants of the base: the product M of the
+ * moduli and, for every modulus, M_i * (M_i^-1 mod m_i).
+ * The product must fit in 64 bits (primes up to 47), otherwise the table 
+ * is returned with M = 0.
+ * 
+ * @param base 
+ * @return CRTTable 
+ */
+CRTTable CRTPrecompute (const vector<int> &base) {
+  CRTTable t;
+  t.base = base;
+
+  uint64_t prod = 1;
+  for (size_t i = 0; i < base.size(); i++) {
+    if (prod > UINT64_MAX / base[i]) {
+      cerr << "The product of the RNS base does not fit in 64 bits" << endl;
+      return t;
+    }
+    prod *= base[i];
+  }
+
+  uint64_t bound = 0;
+  t.coeff.resize(base.size());
+  for (size_t i = 0; i < base.size(); i++) {
+    uint64_t pp = prod / base[i];
+    // M_i * inv < M_i * m_i = M, so it never overflows
+    t.coeff[i] = pp * inv((int) (pp % base[i]), base[i]);
+    bound += base[i] - 1;
+  }
+
+  t.M = prod;
+  t.invM = 1.0 / (double) prod;
+  if (prod <= UINT32_MAX) {
+    t.recipM = (uint32_t) ((UINT64_C(1) << 32) / prod);
+  }
+
+  // Every term is lower than (m_i - 1) * M
+  t.narrow = bound <= UINT32_MAX / prod;
+  t.wide = bound > INT64_MAX / prod;
+  return t;
+}
+
+/**
+ * @brief It reduces the sum of the CRT terms modulo M, estimating the 
+ * quotient in floating point and fixing it with a single correction
+ * 
+ * @param acc 
+ * @param M 
+ * @param invM 
+ * @return uint64_t 
+ */
+static inline uint64_t CRTReduce (uint64_t acc, uint64_t M, double invM) {
+  uint64_t q = (uint64_t) ((double) (int64_t) acc * invM);
+  int64_t r = (int64_t) (acc - q * M);
+
+  if (r < 0) r += M;
+  if ((uint64_t) r >= M) r -= M;
+  return r;
+}
+
+/**
+ * @brief Same as CRTReduce, for a sum that fits in 32 bits: the Barrett
+ * estimate of the quotient is either exact or one less
+ * 
+ * @param acc 
+ * @param M 
+ * @param recipM 
+ * @return uint32_t 
+ */
+static inline uint32_t CRTReduce32 (uint32_t acc, uint32_t M, uint32_t recipM) {
+  uint32_t q = (uint32_t) (((uint64_t) acc * recipM) >> 32);
+  uint32_t r = acc - q * M;
+
+  return r >= M ? r - M : r;
+}
+
+/**
+ * @brief It reconstructs a single integer from its residues, 
+ * read from rem with the given stride
+ * 
+ * @param t 
+ * @param rem 
+ * @param stride Distance between two consecutive residues
+ * @return uint64_t 
+ */
+uint64_t CRTReconstruct (const CRTTable &t, const uint8_t *rem, size_t stride) {
+  if (t.wide) {
+    unsigned __int128 acc = 0;
+    for (size_t i = 0; i < t.coeff.size(); i++) {
+      acc += (unsigned __int128) rem[i * stride] * t.coeff[i];
+    }
+    return (uint64_t) (acc % t.M);
+  }
+
+  uint64_t acc = 0;
+  for (size_t i = 0; i < t.coeff.size(); i++) {
+    acc += rem[i * stride] * t.coeff[i];
+  }
+  return CRTReduce(acc, t.M, t.invM);
+}
+
+/**
+ * @brief Whether a symbol is not lower than limit. Below a power of two 
+ * the bits of all the symbols together tell it, with a single OR each.
+ * 
+ * @tparam T 
+ * @param x 
+ * @param n 
+ * @param limit 
+ * @return true 
+ * @return false 
+ */
+template <typename T>
+static inline bool CRTAbove (const T *x, size_t n, uint64_t limit) {
+  T over = 0;
+  if ((limit & (limit - 1)) == 0) {
+    for (size_t i = 0; i < n; i++) {
+      over |= x[i];
+    }
+    return over >= limit;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    over |= x[i] >= limit;
+  }
+  return over != 0;
+}
+
+/**
+ * @brief It reconstructs n consecutive symbols, whose residues are read 
+ * from one plane per modulus of the table, into x. If limit is given, it 
+ * also tells whether a symbol is not lower than it.
+ * 
+ * @param t 
+ * @param planes 
+ * @param n At most CRTBLOCK symbols
+ * @param x 
+ * @param limit 0 for no check
+ * @return true If a symbol is not lower than limit
+ */
+static bool CRTBlock (const CRTTable &t, const uint8_t * const *planes, 
+                      size_t n, uint64_t * __restrict x, uint64_t limit = 0) {
+  if (t.narrow) {
+    uint32_t acc[CRTBLOCK] = {0};
+    for (size_t j = 0; j < t.coeff.size(); j++) {
+      const uint8_t *plane = planes[j];
+      const uint32_t c = (uint32_t) t.coeff[j];
+      for (size_t i = 0; i < n; i++) {
+        acc[i] += plane[i] * c;
+      }
+    }
+    const uint32_t M = (uint32_t) t.M, recipM = t.recipM;
+    if (limit == 0) {
+      for (size_t i = 0; i < n; i++) {
+        x[i] = CRTReduce32(acc[i], M, recipM);
+      }
+      return false;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      acc[i] = CRTReduce32(acc[i], M, recipM);
+      x[i] = acc[i];
+    }
+    // Every symbol is lower than M
+    return limit < t.M && CRTAbove(acc, n, limit);
+  }
+  else if (!t.wide) {
+    fill(x, x + n, 0);
+    for (size_t j = 0; j < t.coeff.size(); j++) {
+      const uint8_t *plane = planes[j];
+      const uint64_t c = t.coeff[j];
+      for (size_t i = 0; i < n; i++) {
+        x[i] += plane[i] * c;
+      }
+    }
+    const uint64_t M = t.M;
+    const double invM = t.invM;
+    for (size_t i = 0; i < n; i++) {
+      x[i] = CRTReduce(x[i], M, invM);
+    }
+  }
+  else {
+    uint8_t rem[64];
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < t.coeff.size(); j++) {
+        rem[j] = planes[j][i];
+      }
+      x[i] = CRTReconstruct(t, rem, 1);
+    }
+  }
+  return limit != 0 && CRTAbove(x, n, limit);
+}
+
+/**
+ * @brief It writes n symbols of width bytes, little-endian, into out; 
+ * the bytes past the end of the stream (len) are dropped
+ * 
+ * @param x 
+ * @param n 
+ * @param width 
+ * @param out 
+ * @param len Bytes still available in out
+ */
+static void RNSStoreSymbols (const uint64_t *x, size_t n, int width, 
+                             uint8_t *out, size_t len) {
+  if (width == 1) {
+    for (size_t i = 0; i < n; i++) {
+      out[i] = (uint8_t) x[i];
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    for (int b = 0; b < width && i * width + b < len; b++) {
+      out[i * width + b] = (uint8_t) (x[i] >> (8 * b));
+    }
+  }
+}
+
+/**
+ * @brief CRT decoding of a whole block of residues, laid out as one plane
+ * per modulus (as written by RNSEncodeBatch), back into bytes.
+ * 
+ * @param t 
+ * @param residues 
+ * @param len Number of encoded bytes
+ * @param width Bytes per symbol
+ * @param out 
+ * @return true 
+ * @return false If the table is not valid
+ */
+bool CRTDecodeBatch (const CRTTable &t, const uint8_t *residues, size_t len,
+                     int width, uint8_t *out) {
+  if (t.M == 0) return false;
+
+  // The terms are accumulated plane by plane, on blocks that stay in cache
+  const size_t symbols = RNSSymbols(len, width);
+  uint64_t x[CRTBLOCK];
+  vector<const uint8_t *> planes(t.coeff.size());
+
+  for (size_t start = 0; start < symbols; start += CRTBLOCK) {
+    size_t n = min(CRTBLOCK, symbols - start);
+    for (size_t j = 0; j < planes.size(); j++) {
+      planes[j] = residues + j * symbols + start;
+    }
+
+    CRTBlock(t, planes.data(), n, x);
+    RNSStoreSymbols(x, n, width, out + start * width, len - start * width);
+  }
+  return true;
+}
+
+/**
+ * @brief Given the moduli base and the residues, it returns the 
+ * reconstructed integer
+ * 
+ * @param base 
+ * @param rem 
+ * @return uint64_t 
+ */
+uint64_t CRT(const vector<int> &base, const vector<int> &rem) {
+  CRTTable t = CRTPrecompute(base);
+  vector<uint8_t> r(rem.begin(), rem.end());
+
+  return CRTReconstruct(t, r.data(), 1);
+}
+
+/**
+ * @brief Precomputes, for every modulus of the base, the Barrett reciprocal
+ * floor(2^32 / m) used by the batch encoder instead of a division
+ * 
+ * @param base 
+ * @return vector<uint32_t> 
+ */
+vector<uint32_t> RNSReciprocals (const vector<int> &base) {
+  vector<uint32_t> recip(base.size());
+
+  for (size_t j = 0; j < base.size(); j++) {
+    recip[j] = (uint32_t) ((UINT64_C(1) << 32) / base[j]);
+  }
+
+  return recip;
+}
+
+/**
+ * @brief It reduces every byte of data modulo m into the plane.
+ * Barrett reduction: for x < 2^8 the estimate q = (x * r) >> 16 is
+ * either the exact quotient or one less, hence a single correction.
+ * The loop has no division and no branch, so it gets vectorized; it is 
+ * kept out of line since, once inlined, GCC stops using the 16-bit 
+ * multiply-high instructions.
+ * 
+ * @param data 
+ * @param len 
+ * @param m 
+ * @param r floor(2^16 / m)
+ * @param plane 
+ */
+static __attribute__((noinline))
+void RNSReducePlane (const uint8_t *data, size_t len, uint16_t m, 
+                     uint16_t r, uint8_t * __restrict plane) {
+  for (size_t i = 0; i < len; i++) {
+    uint16_t x = data[i];
+    uint16_t q = (uint16_t) (((uint32_t) x * (uint32_t) r) >> 16);
+    uint16_t rem = x - q * m;
+    plane[i] = (uint8_t) (rem >= m ? rem - m : rem);
+  }
+}
+
+/**
+ * @brief Same as RNSReducePlane, for symbols of up to 32 bits: 
+ * with r = floor(2^32 / m), q = (x * r) >> 32 is either the exact 
+ * quotient or one less.
+ * 
+ * @param symbols 
+ * @param len 
+ * @param m 
+ * @param r floor(2^32 / m)
+ * @param plane 
+ */
+static void RNSReducePlane32 (const uint32_t *symbols, size_t len, uint32_t m,
+                              uint32_t r, uint8_t * __restrict plane) {
+  for (size_t i = 0; i < len; i++) {
+    uint32_t x = symbols[i];
+    uint32_t q = (uint32_t) (((uint64_t) x * r) >> 32);
+    uint32_t rem = x - q * m;
+    plane[i] = (uint8_t) (rem >= m ? rem - m : rem);
+  }
+}
+
+/**
+ * @brief Batch RNS encoding of a whole byte stream, read as little-endian
+ * symbols of width bytes (1 to 4). The residues are written into one 
+ * contiguous buffer of RNSSymbols(len, width) * base.size() bytes, laid out 
+ * as one plane per modulus: the residue of symbol i modulo base[j] is 
+ * residues[j * RNSSymbols(len, width) + i].
+ * Every modulus must be in [2, 255], so that a residue fits in a byte.
+ * 
+ * @param data 
+ * @param len 
+ * @param width 
+ * @param base 
+ * @param recip Reciprocals returned by RNSReciprocals(base)
+ * @param residues 
+ */
+void RNSEncodeBatch (const uint8_t *data, size_t len, int width, 
+                     const vector<int> &base, const vector<uint32_t> &recip, 
+                     uint8_t *residues) {
+
+  if (width == 1) {
+    for (size_t j = 0; j < base.size(); j++) {
+      RNSReducePlane(data, len, (uint16_t) base[j], (uint16_t) (recip[j] >> 16),
+                     residues + j * len);
+    }
+    return;
+  }
+
+  // The symbols are assembled once, then reduced by every modulus
+  const size_t n = RNSSymbols(len, width);
+  vector<uint32_t> symbols(n);
+
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t *d = data + i * width;
+    int bytes = (int) min((size_t) width, len - i * width);
+    uint32_t x = 0;
+
+    for (int b = 0; b < bytes; b++) {
+      x |= (uint32_t) d[b] << (8 * b);
+    }
+    symbols[i] = x;
+  }
+
+  for (size_t j = 0; j < base.size(); j++) {
+    RNSReducePlane32(symbols.data(), n, base[j], recip[j], residues + j * n);
+  }
+}
+
+/**
+ * @brief Consistency check of n symbols when the sums of the CRT tables 
+ * of the legitimate and of the redundant residues fit in 32 bits: the 
+ * symbols, rebuilt from the planes of t, must be lower than limit and 
+ * give the value rebuilt from the planes of r modulo its product R. 
+ * Everything is computed in 32-bit lanes, and the faulty symbols are 
+ * flagged only if there are any.
+ * 
+ * @param t CRT over the legitimate moduli
+ * @param planes 
+ * @param r CRT over the redundant moduli
+ * @param checkPlanes 
+ * @param n At most CRTBLOCK symbols
+ * @param limit 
+ * @param x The symbols
+ * @param faulty 1 for a faulty symbol, otherwise 0, if there are any
+ * @return true If a symbol is faulty
+ */
+static bool RRNSCheckNarrow (const CRTTable &t, const uint8_t * const *planes, 
+                             const CRTTable &r, const uint8_t * const *checkPlanes,
+                             size_t n, uint32_t limit, uint64_t *x, uint8_t *faulty) {
+  uint32_t acc[CRTBLOCK] = {0};
+  uint32_t check[CRTBLOCK] = {0};
+  for (size_t j = 0; j < t.coeff.size(); j++) {
+    const uint8_t *plane = planes[j];
+    const uint32_t c = (uint32_t) t.coeff[j];
+    for (size_t i = 0; i < n; i++) {
+      acc[i] += plane[i] * c;
+    }
+  }
+  for (size_t j = 0; j < r.coeff.size(); j++) {
+    const uint8_t *plane = checkPlanes[j];
+    const uint32_t c = (uint32_t) r.coeff[j];
+    for (size_t i = 0; i < n; i++) {
+      check[i] += plane[i] * c;
+    }
+  }
+
+  // Below R a symbol is its own residue modulo R
+  const uint32_t M = (uint32_t) t.M, recipM = t.recipM;
+  const uint32_t R = (uint32_t) r.M, recipR = r.recipM;
+  const bool reduce = limit > R;
+  uint32_t bad = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t v = CRTReduce32(acc[i], M, recipM);
+    uint32_t w = CRTReduce32(check[i], R, recipR);
+    uint32_t u = reduce ? CRTReduce32(v, R, recipR) : v;
+    x[i] = v;
+    check[i] = (v >= limit) | (u != w);
+    bad += check[i];
+  }
+
+  for (size_t i = 0; i < n && bad > 0; i++) {
+    faulty[i] = (uint8_t) check[i];
+  }
+  return bad > 0;
+}
+
+/**
+ * @brief The CRT table of the moduli of base at the given indices, with 
+ * M = 0 if their product does not fit in 64 bits
+ * 
+ * @param base 
+ * @param indices 
+ * @return CRTTable 
+ */
+static CRTTable CRTSubset (const vector<int> &base, const vector<size_t> &indices) {
+  vector<int> moduli;
+  uint64_t prod = 1;
+  for (size_t j : indices) {
+    if (prod > UINT64_MAX / base[j]) return CRTTable();
+    prod *= base[j];
+    moduli.push_back(base[j]);
+  }
+  return moduli.empty() ? CRTTable() : CRTPrecompute(moduli);
+}
+
+/**
+ * @brief It prepares the RRNS decoder of a base, whose first legitimate 
+ * moduli represent the values. The redundant moduli must be greater than 
+ * the legitimate ones.
+ * 
+ * @param base 
+ * @param legitimate Number of legitimate moduli
+ * @param width Bytes per encoded symbol
+ * @return RRNSDecoder 
+ */
+RRNSDecoder RRNSPrecompute (const vector<int> &base, size_t legitimate, 
+                            int width) {
+  vector<size_t> all(base.size()), redundant;
+  iota(all.begin(), all.end(), 0);
+  redundant.assign(all.begin() + legitimate, all.end());
+
+  RRNSDecoder d;
+  d.base = base;
+  d.legitimate = legitimate;
+  d.width = width;
+  d.primary = CRTPrecompute(vector<int>(base.begin(), base.begin() + legitimate));
+  d.redundancy = CRTSubset(base, redundant);
+  d.full = CRTSubset(base, all);
+  d.limit = min(UINT64_C(1) << (8 * width), d.primary.M);
+  return d;
+}
+
+/**
+ * @brief RRNS decoding of a whole block of residues, laid out as one plane
+ * per modulus. By the RRNS property the residues of a symbol agree if and
+ * only if their CRT over all the available moduli is a legitimate value, 
+ * so without errors the decoding costs a plain CRT over those moduli. When
+ * its sums do not fit in 32 bits but those of the legitimate and of the 
+ * redundant moduli do, the symbol is instead rebuilt from the legitimate
+ * residues and checked against the value of the redundant ones, which is 
+ * cheaper.
+ * Only on a mismatch, it searches for the subset of residues which gives a 
+ * legitimate value, discarding up to floor((n - k - s) / 2) faulty residues,
+ * where s is the number of missing ones.
+ * 
+ * @param d 
+ * @param residues 
+ * @param len Number of encoded bytes
+ * @param missing Bit mask of the residue planes that were not received
+ * @param out 
+ * @param stats 
+ * @return true 
+ * @return false If less than legitimate residues are available, or the 
+ * base has more than RRNSMAXMODULI moduli
+ */
+bool RRNSDecodeBatch (const RRNSDecoder &d, const uint8_t *residues, size_t len,
+                      uint32_t missing, uint8_t *out, RRNSStats &stats) {
+  if (d.base.size() > RRNSMAXMODULI) {
+    cerr << "A base of " << d.base.size() << " moduli exceeds the " 
+         << RRNSMAXMODULI << " of the decoder" << endl;
+    return false;
+  }
+
+  const size_t symbols = RNSSymbols(len, d.width);
+  vector<size_t> present;
+  for (size_t j = 0; j < d.base.size(); j++) {
+    if (!(missing >> j & 1)) present.push_back(j);
+  }
+
+  if (present.size() < d.legitimate || d.primary.M == 0) {
+    cerr << "Not enough residues to decode: " << present.size() 
+         << " out of " << d.base.size() << endl;
+    return false;
+  }
+
+  // The first k available residues give the value, the others check it
+  const size_t k = d.legitimate;
+  vector<size_t> primary(present.begin(), present.begin() + k);
+  vector<size_t> checks(present.begin() + k, present.end());
+
+  CRTTable full = d.full, table = d.primary, redundancy = d.redundancy;
+  if (present.size() < d.base.size()) {
+    full = CRTSubset(d.base, present);
+    table = CRTSubset(d.base, primary);
+    redundancy = CRTSubset(d.base, checks);
+  }
+  const bool split = !full.narrow && table.narrow && redundancy.narrow;
+
+  // FAST PATH //
+  uint64_t x[CRTBLOCK];
+  uint8_t faulty[CRTBLOCK];
+  vector<const uint8_t *> planes(present.size());
+  vector<size_t> mismatches;
+
+  for (size_t start = 0; start < symbols; start += CRTBLOCK) {
+    size_t n = min(CRTBLOCK, symbols - start);
+    for (size_t p = 0; p < present.size(); p++) {
+      planes[p] = residues + present[p] * symbols + start;
+    }
+
+    /* Symbols fit in 32 bits, larger values are already faulty. Without a
+     * product of all the moduli in 64 bits, every redundant residue is 
+     * checked on its own.
+     */
+    bool dirty;
+    if (split) {
+      dirty = RRNSCheckNarrow(table, planes.data(), redundancy, planes.data() + k,
+                              n, (uint32_t) d.limit, x, faulty);
+    }
+    else if (full.M != 0) {
+      // The 32-bit sums are checked as they are reduced, the 64-bit ones after
+      if (full.narrow) {
+        dirty = CRTBlock(full, planes.data(), n, x, d.limit);
+      }
+      else {
+        CRTBlock(full, planes.data(), n, x);
+        dirty = CRTAbove(x, n, d.limit);
+      }
+      for (size_t i = 0; i < n && dirty; i++) {
+        faulty[i] = x[i] >= d.limit;
+      }
+    }
+    else {
+      dirty = true;
+      CRTBlock(table, planes.data(), n, x);
+      for (size_t i = 0; i < n; i++) {
+        faulty[i] = x[i] >= d.limit;
+      }
+      for (size_t p = k; p < present.size(); p++) {
+        const uint8_t *plane = planes[p];
+        const uint32_t m = d.base[present[p]];
+
+        for (size_t i = 0; i < n; i++) {
+          faulty[i] |= (uint32_t) x[i] % m != plane[i];
+        }
+      }
+    }
+
+    RNSStoreSymbols(x, n, d.width, out + start * d.width, len - start * d.width);
+    for (size_t i = 0; i < n && dirty; i++) {
+      if (faulty[i]) mismatches.push_back(start + i);
+    }
+  }
+
+  if (mismatches.empty()) return true;
+
+  // SLOW PATH //
+  /* Every way of discarding e = 1..t of the available residues has its own
+   * CRT table; by the RRNS property only discarding the faulty ones
+   * gives back a value in the legitimate range.
+   */
+  size_t t = (present.size() - d.legitimate) / 2;
+  vector<vector<size_t>> subsets;
+  vector<CRTTable> tables;
+
+  for (size_t e = 1; e <= t; e++) {
+    vector<bool> drop(present.size(), false);
+    fill(drop.end() - e, drop.end(), true);
+
+    do {
+      vector<size_t> kept;
+      vector<int> moduli;
+      for (size_t p = 0; p < present.size(); p++) {
+        if (!drop[p]) {
+          kept.push_back(present[p]);
+          moduli.push_back(d.base[present[p]]);
+        }
+      }
+      subsets.push_back(kept);
+      tables.push_back(CRTPrecompute(moduli));
+    } while (next_permutation(drop.begin(), drop.end()));
+  }
+
+  uint8_t rem[RRNSMAXMODULI];
+  for (size_t i : mismatches) {
+    bool fixed = false;
+
+    for (size_t s = 0; s < subsets.size() && !fixed; s++) {
+      if (tables[s].M == 0) continue;
 
-  int k = sizeof(base) / sizeof(base[0]);
+      for (size_t p = 0; p < subsets[s].size(); p++) {
+        rem[p] = residues[subsets[s][p] * symbols + i];
+      }
+
+      uint64_t x = CRTReconstruct(tables[s], rem, 1);
+      if (x < d.limit) {
+        RNSStoreSymbols(&x, 1, d.width, out + i * d.width, len - i * d.width);
+        fixed = true;
+      }
+    }
+
+    if (fixed) stats.corrected++;
+    else stats.uncorrectable++;
+  }
+
+  return true;
+}
+
+/* Packed residues format, all integers little-endian:
+ *   "RRNS" | version (1 byte) | symbol width (1 byte) | n (1 byte) | 
+ *   n moduli (1 byte each) | number of encoded bytes (8 bytes) | 
+ *   n bit-packed planes
+ * Plane j stores the residues modulo base[j] in ceil(log2(base[j])) bits 
+ * each, LSB first, and starts on a byte boundary.
+ */
+const char RRNSMAGIC[4] = {'R', 'R', 'N', 'S'};
+const uint8_t RRNSVERSION = 2;
+
+/**
+ * @brief It returns the number of bits needed by the residues 
+ * of every modulus of the base
+ * 
+ * @param base 
+ * @return vector<int> 
+ */
+vector<int> RNSBitWidths (const vector<int> &base) {
+  vector<int> widths(base.size());
+
+  for (size_t j = 0; j < base.size(); j++) {
+    int w = 1;
+    while ((1 << w) < base[j]) w++;
+    widths[j] = w;
+  }
+  return widths;
+}
+
+/**
+ * @brief Size in bytes of len encoded bytes once packed, header included
+ * 
+ * @param base 
+ * @param width Bytes per symbol
+ * @param len 
+ * @return size_t 
+ */
+size_t RRNSPackedSize (const vector<int> &base, int width, size_t len) {
+  size_t size = sizeof(RRNSMAGIC) + 3 + base.size() + 8;
+  size_t symbols = RNSSymbols(len, width);
+  vector<int> widths = RNSBitWidths(base);
 
-  int prod = 1;
-  for (int i = 0; i < k; i++)
-      prod *= base[i];
+  for (size_t j = 0; j < base.size(); j++) {
+    size += (symbols * widths[j] + 7) / 8;
+  }
+  return size;
+}
 
-  int result = 0;
-  for (int i = 0; i < k; i++) {
-      int pp = prod / base[i];
-      result += rem[i] * inv(pp, base[i]) * pp;
+/**
+ * @brief It packs the groups of eight residues of a plane, W bits each:
+ * a group fills exactly W bytes, so it is shifted into a 64-bit word, 
+ * stored at once, and the next group starts on the following byte. 
+ * The word spills up to 8 - W bytes past the group.
+ * 
+ * @tparam W Bits per residue
+ * @param plane 
+ * @param groups 
+ * @param p It advances past the groups
+ */
+template <int W>
+static void packGroups (const uint8_t *plane, size_t groups, uint8_t *&p) {
+  for (size_t g = 0; g < groups; g++, plane += 8, p += W) {
+    uint64_t word = 0;
+    for (int k = 0; k < 8; k++) {
+      word |= (uint64_t) plane[k] << (k * W);
+    }
+    memcpy(p, &word, 8);
   }
+}
 
-  return result % prod;
-}
\ No newline at end of file
+/**
+ * @brief It unpacks the groups of eight residues written by packGroups;
+ * every group loads 8 bytes, which must be readable
+ * 
+ * @tparam W Bits per residue
+ * @param p 
+ * @param groups 
+ * @param plane 
+ */
+template <int W>
+static void unpackGroups (const uint8_t *p, size_t groups, uint8_t *plane) {
+  const uint64_t mask = (1u << W) - 1;
+  for (size_t g = 0; g < groups; g++, plane += 8, p += W) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    for (int k = 0; k < 8; k++) {
+      plane[k] = (uint8_t) ((word >> (k * W)) & mask);
+    }
+  }
+}
+
+// Kernels of the groups, by bits per residue (the moduli are below 256)
+static void (*const PACKGROUPS[9]) (const uint8_t *, size_t, uint8_t *&) = {
+  nullptr, packGroups<1>, packGroups<2>, packGroups<3>, packGroups<4>, 
+  packGroups<5>, packGroups<6>, packGroups<7>, packGroups<8>
+};
+static void (*const UNPACKGROUPS[9]) (const uint8_t *, size_t, uint8_t *) = {
+  nullptr, unpackGroups<1>, unpackGroups<2>, unpackGroups<3>, unpackGroups<4>, 
+  unpackGroups<5>, unpackGroups<6>, unpackGroups<7>, unpackGroups<8>
+};
+
+/**
+ * @brief It packs the residue planes written by RNSEncodeBatch into the 
+ * compact wire format
+ * 
+ * @param base 
+ * @param width Bytes per symbol
+ * @param residues 
+ * @param len Number of encoded bytes
+ * @param packed 
+ */
+void RRNSPack (const vector<int> &base, int width, const uint8_t *residues, 
+               size_t len, vector<uint8_t> &packed) {
+  const size_t symbols = RNSSymbols(len, width);
+  vector<int> widths = RNSBitWidths(base);
+  const size_t size = RRNSPackedSize(base, width, len);
+
+  // Every group of residues is written as a whole word, which may spill 8 bytes
+  packed.assign(size + 8, 0);
+
+  uint8_t *p = packed.data();
+  memcpy(p, RRNSMAGIC, sizeof(RRNSMAGIC));
+  p += sizeof(RRNSMAGIC);
+  *p++ = RRNSVERSION;
+  *p++ = (uint8_t) width;
+  *p++ = (uint8_t) base.size();
+  for (size_t j = 0; j < base.size(); j++) {
+    *p++ = (uint8_t) base[j];
+  }
+  for (int b = 0; b < 8; b++) {
+    *p++ = (uint8_t) ((uint64_t) len >> (8 * b));
+  }
+
+  // Residues go by groups of eight, only the last ones of a plane one by one
+  for (size_t j = 0; j < base.size(); j++) {
+    const uint8_t *plane = residues + j * symbols;
+    const int w = widths[j];
+    size_t i = symbols / 8 * 8;
+    PACKGROUPS[w](plane, symbols / 8, p);
+
+    uint64_t buffer = 0;
+    int bits = 0;
+    for (; i < symbols; i++) {
+      buffer |= (uint64_t) plane[i] << bits;
+      bits += w;
+    }
+    while (bits > 0) {
+      *p++ = (uint8_t) buffer;
+      buffer >>= 8;
+      bits -= 8;
+    }
+  }
+  packed.resize(size);
+}
+
+/**
+ * @brief It unpacks a buffer in the compact wire format back into 
+ * residue planes, returning the base and symbol width it was encoded with
+ * 
+ * @param packed 
+ * @param size 
+ * @param base 
+ * @param width 
+ * @param len Number of encoded bytes
+ * @param residues 
+ * @return true 
+ * @return false If the buffer is not a valid packed residues buffer
+ */
+bool RRNSUnpack (const uint8_t *packed, size_t size, vector<int> &base,
+                 int &width, size_t &len, vector<uint8_t> &residues) {
+  const size_t fixed = sizeof(RRNSMAGIC) + 3;
+
+  if (size < fixed || memcmp(packed, RRNSMAGIC, sizeof(RRNSMAGIC)) != 0 ||
+      packed[sizeof(RRNSMAGIC)] != RRNSVERSION) {
+    cerr << "Not a packed residues buffer" << endl;
+    return false;
+  }
+
+  width = packed[sizeof(RRNSMAGIC) + 1];
+  size_t n = packed[sizeof(RRNSMAGIC) + 2];
+  if (width < 1 || width > 4 || n > RRNSMAXMODULI || size < fixed + n + 8) {
+    cerr << "Invalid packed residues header" << endl;
+    return false;
+  }
+
+  const uint8_t *p = packed + fixed;
+  base.assign(p, p + n);
+  p += n;
+
+  uint64_t bytes = 0;
+  for (int b = 0; b < 8; b++) {
+    bytes |= (uint64_t) *p++ << (8 * b);
+  }
+  len = bytes;
+
+  if (size != RRNSPackedSize(base, width, len)) {
+    cerr << "Packed residues size mismatch" << endl;
+    return false;
+  }
+
+  const size_t symbols = RNSSymbols(len, width);
+  vector<int> widths = RNSBitWidths(base);
+  residues.resize(symbols * n);
+
+  /* As in RRNSPack the residues go by groups of eight, whose words may 
+   * reach into the next plane, but not past the buffer
+   */
+  const uint8_t *end = packed + size;
+  for (size_t j = 0; j < n; j++) {
+    uint8_t *plane = residues.data() + j * symbols;
+    const int w = widths[j];
+    const uint64_t mask = (1u << w) - 1;
+    size_t bytes = (symbols * w + 7) / 8;
+    size_t left = end - p;
+    size_t groups = left < 8 ? 0 : min(symbols / 8, (left - 8) / w + 1);
+    UNPACKGROUPS[w](p, groups, plane);
+    size_t i = groups * 8;
+    size_t k = groups * w;
+
+    uint64_t buffer = 0;
+    int bits = 0;
+    for (; i < symbols; i++) {
+      if (bits < w) {
+        uint32_t word = 0;
+        size_t take = min((size_t) 4, bytes - k);
+        memcpy(&word, p + k, take);
+        k += take;
+        buffer |= (uint64_t) word << bits;
+        bits += 8 * take;
+      }
+      plane[i] = (uint8_t) (buffer & mask);
+      buffer >>= w;
+      bits -= w;
+    }
+    p += bytes;
+  }
+  return true;
+}
+// Bytes read from the dataset at every refill
+#define DATASETBLOCK (1 << 16)
+
+static inline bool isBlank (char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool isDigit (char c) {
+  return (unsigned char) (c - '0') <= 9;
+}
+
+/**
+ * @brief It opens the dataset file; the outcome is given by good(),
+ * which turns false also after a malformed value
+ * 
+ * @param filename 
+ * @param chunkSize Number of values per chunk
+ */
+DatasetReader::DatasetReader (const string &filename, size_t chunkSize) 
+  : chunkSize(chunkSize), buffer(DATASETBLOCK) {
+  
+  fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Could not read " << filename << endl;
+  }
+}
+
+DatasetReader::~DatasetReader () {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool DatasetReader::good () const {
+  return fd >= 0 && !malformed;
+}
+
+/**
+ * @brief It moves the unparsed bytes at the beginning of the buffer,
+ * then fills the rest of it from the file
+ * 
+ * @return true If new bytes were read
+ * @return false At the end of the file
+ */
+bool DatasetReader::refill () {
+  if (eof || fd < 0) return false;
+
+  memmove(buffer.data(), buffer.data() + pos, end - pos);
+  end -= pos;
+  pos = 0;
+
+  // A single value longer than the buffer, it grows to hold it
+  if (end == buffer.size()) {
+    buffer.resize(2 * buffer.size());
+  }
+
+  ssize_t n;
+  do {
+    n = read(fd, buffer.data() + end, buffer.size() - end);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    eof = true;
+    return false;
+  }
+  end += n;
+  return true;
+}
+
+/**
+ * @brief It returns the next whitespace separated token, which is 
+ * always whole in the buffer, refilling it if the token is cut
+ * 
+ * @param len Length of the token
+ * @return const char* Null at the end of the file
+ */
+const char *DatasetReader::token (size_t &len) {
+  while (true) {
+    while (pos < end && isBlank(buffer[pos])) pos++;
+
+    size_t last = pos;
+    while (last < end && !isBlank(buffer[last])) last++;
+
+    // The token ends inside the buffer, or it is the last of the file
+    if (last < end || (eof && last > pos)) {
+      len = last - pos;
+      const char *p = buffer.data() + pos;
+      pos = last;
+      return p;
+    }
+
+    if (!refill() && pos == end) return nullptr;
+  }
+}
+
+/**
+ * @brief Parsing of a decimal integer
+ * 
+ * @param p 
+ * @param len 
+ * @param value 
+ * @return true 
+ * @return false If the token is not an integer
+ */
+static bool parseValue (const char *p, size_t len, int64_t &value) {
+  const char *last = p + len;
+  bool negative = (*p == '-');
+  if (*p == '-' || *p == '+') p++;
+  if (p == last) return false;
+
+  uint64_t v = 0;
+  for (; p < last; p++) {
+    unsigned d = (unsigned char) *p - '0';
+    if (d > 9) return false;
+    v = v * 10 + d;
+  }
+  value = negative ? -(int64_t) v : (int64_t) v;
+  return true;
+}
+
+/**
+ * @brief Parsing of a decimal number. Whenever the digits fit in 53 bits 
+ * and the power of ten is exact in a double, a single multiplication or 
+ * division is correctly rounded; otherwise it falls back to strtod.
+ * 
+ * @param p 
+ * @param len 
+ * @param value 
+ * @return true 
+ * @return false If the token is not a number
+ */
+static bool parseValue (const char *p, size_t len, double &value) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const char *first = p;
+  const char *last = p + len;
+  bool negative = (*p == '-');
+  if (*p == '-' || *p == '+') p++;
+
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  bool any = false;
+
+  for (; p < last && isDigit(*p); p++, any = true) {
+    if (mantissa == 0 && *p == '0') continue;
+    mantissa = mantissa * 10 + (*p - '0');
+    digits++;
+  }
+  if (p < last && *p == '.') {
+    for (p++; p < last && isDigit(*p); p++, any = true) {
+      if (mantissa == 0 && *p == '0') { exponent--; continue; }
+      mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+      exponent--;
+    }
+  }
+
+  if (any && p == last && digits <= 15 && exponent >= -22) {
+    double v = (double) mantissa;
+    value = negative ? -v / pow10[-exponent] : v / pow10[-exponent];
+    return true;
+  }
+
+  // Exponents, long mantissas and anything unusual
+  string s(first, len);
+  char *stop;
+  value = strtod(s.c_str(), &stop);
+  return len > 0 && *stop == '\0';
+}
+
+/**
+ * @brief It fills chunk with the next chunkSize values of the dataset,
+ * or with the remaining ones at the end of the file
+ * 
+ * @tparam T 
+ * @param chunk 
+ * @return true If at least a value was read
+ * @return false At the end of the dataset, or on a malformed value
+ */
+template <typename T>
+bool DatasetReader::nextChunk (vector<T> &chunk) {
+  chunk.clear();
+  chunk.reserve(chunkSize);
+
+  size_t len;
+  const char *p;
+  while (chunk.size() < chunkSize && (p = token(len)) != nullptr) {
+    T value;
+    if (!parseValue(p, len, value)) {
+      cerr << "Malformed value in the dataset: " << string(p, len) << endl;
+      malformed = true;
+      chunk.clear();
+      return false;
+    }
+    chunk.push_back(value);
+  }
+  return !chunk.empty();
+}
+
+bool DatasetReader::next (vector<int64_t> &chunk) {
+  return nextChunk(chunk);
+}
+
+bool DatasetReader::next (vector<double> &chunk) {
+  return nextChunk(chunk);
+}
+
+/**
+ * @brief It maps the file read-only; the outcome is given by good().
+ * An empty file is valid and has no bytes.
+ * 
+ * @param filename 
+ */
+MappedFile::MappedFile (const string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    cerr << "Could not read " << filename << endl;
+    if (fd >= 0) close(fd);
+    return;
+  }
+
+  length = st.st_size;
+  if (length > 0) {
+    void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      cerr << "Could not map " << filename << endl;
+      close(fd);
+      length = 0;
+      return;
+    }
+    madvise(p, length, MADV_SEQUENTIAL);
+    bytes = (const uint8_t *) p;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  valid = true;
+}
+
+MappedFile::~MappedFile () {
+  if (bytes != nullptr) {
+    munmap((void *) bytes, length);
+  }
+}
+
+bool MappedFile::good () const {
+  return valid;
+}
+
+const uint8_t *MappedFile::data () const {
+  return bytes;
+}
+
+size_t MappedFile::size () const {
+  return length;
+}
+
+/* Layout of an archive, in host byte order: the header is the magic, the
+ * version, the number of index entries and the offset of the index; every
+ * entry is the offset, length and FNV-1a checksum of a record
+ */
+static const char ARCHIVEMAGIC[8] = {'R', 'R', 'N', 'S', 'A', 'R', 'C', 'H'};
+static const uint32_t ARCHIVEVERSION = 1;
+static const size_t ARCHIVEHEADER = 32;
+static const size_t ARCHIVEENTRY = 24;
+
+/**
+ * @brief It creates the archive, with an empty header: an archive that 
+ * is not closed has no index and cannot be read
+ * 
+ * @param filename 
+ * @param io If not null, the batches are written asynchronously through it
+ * @param batchBytes Bytes of records kept in memory before being written
+ */
+ArchiveWriter::ArchiveWriter (const string &filename, AsyncIO *io, size_t batchBytes) 
+  : filename(filename), io(io), batch(batchBytes), pendingOffset(ARCHIVEHEADER) {
+  
+  fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cerr << "Could not create " << filename << endl;
+    return;
+  }
+
+  uint8_t header[ARCHIVEHEADER] = {0};
+  valid = write(header, sizeof(header), 0);
+}
+
+ArchiveWriter::~ArchiveWriter () {
+  // The batches in flight refer to the descriptor and to this object
+  unique_lock<mutex> guard(lock);
+  written.wait(guard, [this]() { return inFlight == 0; });
+
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+bool ArchiveWriter::good () const {
+  return valid;
+}
+
+/**
+ * @brief Positional write of all the bytes
+ * 
+ * @param data 
+ * @param len 
+ * @param offset 
+ * @return true 
+ * @return false 
+ */
+bool ArchiveWriter::write (const uint8_t *data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      cerr << "Could not write " << filename << endl;
+      return false;
+    }
+    data += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/**
+ * @brief It appends a record. Its checksum is computed by the calling 
+ * thread; once a batch is full, it is written outside the lock, at the 
+ * offset its records were given, or handed to the asynchronous I/O.
+ * 
+ * @param id 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false If the archive could not be written
+ */
+bool ArchiveWriter::append (size_t id, const uint8_t *data, size_t len) {
+  Entry entry;
+  entry.length = len;
+  entry.checksum = FNV1a(data, len);
+
+  vector<uint8_t> full;
+  uint64_t fullOffset = 0;
+  {
+    lock_guard<mutex> guard(lock);
+    if (!valid) return false;
+
+    if (index.size() <= id) {
+      index.resize(id + 1);
+    }
+    entry.offset = pendingOffset + pending.size();
+    index[id] = entry;
+    pending.insert(pending.end(), data, data + len);
+
+    if (pending.size() >= batch) {
+      full.swap(pending);
+      fullOffset = pendingOffset;
+      pendingOffset += full.size();
+      if (io != nullptr) inFlight++;
+    }
+  }
+
+  if (!full.empty() && io != nullptr) {
+    io->write(fd, move(full), fullOffset, [this](bool ok, vector<uint8_t> &) {
+      if (!ok) {
+        cerr << "Could not write " << filename << endl;
+      }
+      lock_guard<mutex> guard(lock);
+      valid = valid && ok;
+      inFlight--;
+      written.notify_all();
+    });
+    return true;
+  }
+
+  if (!full.empty() && !write(full.data(), full.size(), fullOffset)) {
+    lock_guard<mutex> guard(lock);
+    valid = false;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It waits for the batches in flight, then it writes the last 
+ * batch, the index after the records and the header pointing to it
+ * 
+ * @return true 
+ * @return false If the archive could not be written
+ */
+bool ArchiveWriter::close () {
+  unique_lock<mutex> guard(lock);
+  written.wait(guard, [this]() { return inFlight == 0; });
+  if (!valid) return false;
+  valid = false;
+
+  if (!write(pending.data(), pending.size(), pendingOffset)) return false;
+  uint64_t indexOffset = pendingOffset + pending.size();
+  pending.clear();
+
+  vector<uint8_t> entries(index.size() * ARCHIVEENTRY);
+  for (size_t i = 0; i < index.size(); i++) {
+    memcpy(&entries[i * ARCHIVEENTRY], &index[i].offset, 8);
+    memcpy(&entries[i * ARCHIVEENTRY + 8], &index[i].length, 8);
+    memcpy(&entries[i * ARCHIVEENTRY + 16], &index[i].checksum, 8);
+  }
+  if (!write(entries.data(), entries.size(), indexOffset)) return false;
+
+  uint8_t header[ARCHIVEHEADER] = {0};
+  uint64_t count = index.size();
+  memcpy(header, ARCHIVEMAGIC, 8);
+  memcpy(header + 8, &ARCHIVEVERSION, 4);
+  memcpy(header + 16, &count, 8);
+  memcpy(header + 24, &indexOffset, 8);
+  if (!write(header, sizeof(header), 0)) return false;
+
+  if (::close(fd) < 0) {
+    cerr << "Could not write " << filename << endl;
+    fd = -1;
+    return false;
+  }
+  fd = -1;
+  return true;
+}
+
+/**
+ * @brief It maps the archive and validates its header and index
+ * 
+ * @param filename 
+ */
+ArchiveReader::ArchiveReader (const string &filename) 
+  : file(filename), filename(filename) {
+
+  if (!file.good()) return;
+
+  const uint8_t *p = file.data();
+  uint32_t version = 0;
+  uint64_t entries = 0, indexOffset = 0;
+
+  if (file.size() >= ARCHIVEHEADER) {
+    memcpy(&version, p + 8, 4);
+    memcpy(&entries, p + 16, 8);
+    memcpy(&indexOffset, p + 24, 8);
+  }
+
+  if (file.size() < ARCHIVEHEADER || memcmp(p, ARCHIVEMAGIC, 8) != 0 || 
+      version != ARCHIVEVERSION) {
+    cerr << filename << " is not a closed archive" << endl;
+    return;
+  }
+
+  if (indexOffset < ARCHIVEHEADER || indexOffset > file.size() ||
+      entries > (file.size() - indexOffset) / ARCHIVEENTRY) {
+    cerr << "The index of " << filename << " is truncated" << endl;
+    return;
+  }
+
+  index = p + indexOffset;
+  count = entries;
+
+  // Descriptor for the asynchronous reads
+  fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Could not read " << filename << endl;
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uint64_t offset, length;
+    memcpy(&offset, index + i * ARCHIVEENTRY, 8);
+    memcpy(&length, index + i * ARCHIVEENTRY + 8, 8);
+    if (offset != 0 && (offset < ARCHIVEHEADER || offset > indexOffset || 
+                        length > indexOffset - offset)) {
+      cerr << "Record " << i << " of " << filename << " is out of bounds" << endl;
+      return;
+    }
+  }
+  valid = true;
+}
+
+ArchiveReader::~ArchiveReader () {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool ArchiveReader::good () const {
+  return valid;
+}
+
+/**
+ * @brief Number of entries of the index, the greatest id plus one
+ * 
+ * @return size_t 
+ */
+size_t ArchiveReader::size () const {
+  return count;
+}
+
+/**
+ * @brief Index entry of a record
+ * 
+ * @param id 
+ * @param offset 
+ * @param length 
+ * @param checksum 
+ * @return true 
+ * @return false If the record is missing
+ */
+bool ArchiveReader::entry (size_t id, uint64_t &offset, uint64_t &length, 
+                           uint64_t &checksum) const {
+  offset = 0;
+  if (valid && id < count) {
+    memcpy(&offset, index + id * ARCHIVEENTRY, 8);
+    memcpy(&length, index + id * ARCHIVEENTRY + 8, 8);
+    memcpy(&checksum, index + id * ARCHIVEENTRY + 16, 8);
+  }
+
+  if (offset == 0) {
+    cerr << "Record " << id << " is missing from " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Bytes of a record, inside the mapping; its checksum is verified
+ * 
+ * @param id 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false If the record is missing or corrupted
+ */
+bool ArchiveReader::get (size_t id, const uint8_t *&data, size_t &len) const {
+  uint64_t offset, length, checksum;
+  if (!entry(id, offset, length, checksum)) return false;
+
+  data = file.data() + offset;
+  len = length;
+  if (FNV1a(data, len) != checksum) {
+    cerr << "Record " << id << " of " << filename << " is corrupted" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It reads a record through the asynchronous I/O instead of the 
+ * mapping; the callback gets its bytes once their checksum is verified
+ * 
+ * @param io 
+ * @param id 
+ * @param done Called with ok false if the record is missing or corrupted
+ */
+void ArchiveReader::readAsync (AsyncIO &io, size_t id, AsyncIO::Callback done) const {
+  uint64_t offset, length, checksum;
+  if (!entry(id, offset, length, checksum)) {
+    vector<uint8_t> none;
+    done(false, none);
+    return;
+  }
+
+  io.read(fd, offset, length, [this, id, checksum, done](bool ok, vector<uint8_t> &data) {
+    if (ok && FNV1a(data.data(), data.size()) != checksum) {
+      cerr << "Record " << id << " of " << filename << " is corrupted" << endl;
+      ok = false;
+    }
+    done(ok, data);
+  });
+}
+
+// I/O threads of the fallback backend
+static const int IOTHREADS = 4;
+
+/**
+ * @brief It starts the workers, and the io_uring with its reaper or, if 
+ * it is not available, the I/O threads
+ * 
+ * @param workers Threads running the callbacks
+ * @param depth 
+ */
+AsyncIO::AsyncIO (int workers, size_t depth) : depth(max((size_t) 1, depth)) {
+#ifdef HAVE_LIBURING
+  int err = io_uring_queue_init(2 * this->depth + 1, &ring, 0);
+  ringReady = err == 0;
+  if (!ringReady) {
+    cerr << "Could not set up io_uring (" << strerror(-err) 
+         << "), falling back to I/O threads" << endl;
+  }
+#endif
+
+  for (int i = 0; i < max(1, workers); i++) {
+    this->workers.emplace_back(&AsyncIO::work, this);
+  }
+
+#ifdef HAVE_LIBURING
+  if (ringReady) {
+    servers.emplace_back(&AsyncIO::reap, this);
+    return;
+  }
+#endif
+  for (int i = 0; i < IOTHREADS; i++) {
+    servers.emplace_back(&AsyncIO::serve, this);
+  }
+}
+
+/**
+ * @brief It waits for all the requests, then stops the threads
+ */
+AsyncIO::~AsyncIO () {
+  drain();
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+
+#ifdef HAVE_LIBURING
+  // A request without data wakes the reaper up to stop
+  if (ringReady) {
+    lock_guard<mutex> guard(ringLock);
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data(sqe, nullptr);
+    io_uring_submit(&ring);
+  }
+#endif
+
+  for (thread &t : servers) t.join();
+  for (thread &t : workers) t.join();
+
+#ifdef HAVE_LIBURING
+  if (ringReady) {
+    io_uring_queue_exit(&ring);
+  }
+#endif
+}
+
+const char *AsyncIO::backend () const {
+#ifdef HAVE_LIBURING
+  if (ringReady) return "io_uring";
+#endif
+  return "threads";
+}
+
+/**
+ * @brief It reads len bytes at offset; the callback gets them, or ok false
+ * 
+ * @param fd 
+ * @param offset 
+ * @param len 
+ * @param done 
+ */
+void AsyncIO::read (int fd, uint64_t offset, size_t len, Callback done) {
+  {
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [this]() { return reads < depth; });
+    reads++;
+    pending++;
+  }
+
+  Request *r = new Request;
+  r->fd = fd;
+  r->offset = offset;
+  r->data.resize(len);
+  r->callback = done;
+  submit(r);
+}
+
+/**
+ * @brief It writes the data at offset, then calls back with ok false on errors
+ * 
+ * @param fd 
+ * @param data 
+ * @param offset 
+ * @param done 
+ */
+void AsyncIO::write (int fd, vector<uint8_t> data, uint64_t offset, Callback done) {
+  {
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [this]() { return writes < depth; });
+    writes++;
+    pending++;
+  }
+
+  Request *r = new Request;
+  r->write = true;
+  r->fd = fd;
+  r->offset = offset;
+  r->data.swap(data);
+  r->callback = done;
+  submit(r);
+}
+
+/**
+ * @brief It waits until every request has completed and its callback returned
+ */
+void AsyncIO::drain () {
+  unique_lock<mutex> guard(lock);
+  changed.wait(guard, [this]() { return pending == 0; });
+}
+
+/**
+ * @brief It hands the rest of a request to the backend
+ * 
+ * @param r 
+ */
+void AsyncIO::submit (Request *r) {
+  if (r->data.size() == r->done) {
+    complete(r);
+    return;
+  }
+
+#ifdef HAVE_LIBURING
+  if (ringReady) {
+    lock_guard<mutex> guard(ringLock);
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    if (r->write) {
+      io_uring_prep_write(sqe, r->fd, r->data.data() + r->done, 
+                          r->data.size() - r->done, r->offset + r->done);
+    }
+    else {
+      io_uring_prep_read(sqe, r->fd, r->data.data() + r->done, 
+                         r->data.size() - r->done, r->offset + r->done);
+    }
+    io_uring_sqe_set_data(sqe, r);
+    io_uring_submit(&ring);
+    return;
+  }
+#endif
+
+  {
+    lock_guard<mutex> guard(lock);
+    queue.push_back(r);
+  }
+  changed.notify_all();
+}
+
+/**
+ * @brief The I/O of a request is over: its write slot is released and 
+ * its callback queued for the workers
+ * 
+ * @param r 
+ */
+void AsyncIO::complete (Request *r) {
+  {
+    lock_guard<mutex> guard(lock);
+    if (r->write) writes--;
+    callbacks.push_back(r);
+  }
+  changed.notify_all();
+}
+
+/**
+ * @brief Worker loop: it runs the callbacks, then releases the read slots
+ */
+void AsyncIO::work () {
+  while (true) {
+    Request *r;
+    {
+      unique_lock<mutex> guard(lock);
+      changed.wait(guard, [this]() { return stopping || !callbacks.empty(); });
+      if (callbacks.empty()) return;
+      r = callbacks.front();
+      callbacks.pop_front();
+    }
+
+    if (r->callback) {
+      r->callback(r->ok, r->data);
+    }
+
+    {
+      lock_guard<mutex> guard(lock);
+      if (!r->write) reads--;
+      pending--;
+    }
+    changed.notify_all();
+    delete r;
+  }
+}
+
+/**
+ * @brief I/O thread loop of the fallback backend, with blocking pread and pwrite
+ */
+void AsyncIO::serve () {
+  while (true) {
+    Request *r;
+    {
+      unique_lock<mutex> guard(lock);
+      changed.wait(guard, [this]() { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      r = queue.front();
+      queue.pop_front();
+    }
+
+    while (r->done < r->data.size()) {
+      ssize_t n = r->write ? pwrite(r->fd, r->data.data() + r->done, 
+                                    r->data.size() - r->done, r->offset + r->done)
+                           : pread(r->fd, r->data.data() + r->done, 
+                                   r->data.size() - r->done, r->offset + r->done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        r->ok = false;
+        break;
+      }
+      r->done += n;
+    }
+    complete(r);
+  }
+}
+
+/**
+ * @brief Completion loop of the io_uring: short transfers are submitted
+ * again for the rest, until the request is done or fails
+ */
+void AsyncIO::reap () {
+#ifdef HAVE_LIBURING
+  while (true) {
+    struct io_uring_cqe *cqe;
+    if (io_uring_wait_cqe(&ring, &cqe) < 0) continue;
+
+    Request *r = (Request *) io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+    if (r == nullptr) return;
+
+    if (res == -EINTR || res == -EAGAIN) {
+      submit(r);
+    }
+    else if (res <= 0) {
+      r->ok = false;
+      complete(r);
+    }
+    else {
+      r->done += res;
+      submit(r);
+    }
+  }
+#endif
+}
+
+/**
+ * @brief Minimum, median and 99th percentile (nearest rank) of the samples
+ * 
+ * @param samples 
+ * @return BenchStats All zero without samples
+ */
+BenchStats benchSummary (vector<double> samples) {
+  BenchStats stats;
+  size_t n = samples.size();
+  if (n == 0) return stats;
+
+  sort(samples.begin(), samples.end());
+  stats.min = samples[0];
+  stats.median = n % 2 ? samples[n / 2] 
+                       : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+  stats.p99 = samples[(size_t) ceil(0.99 * n) - 1];
+  return stats;
+}
+
+void Metrics::Counter::add (uint64_t value) {
+  total.fetch_add(value, memory_order_relaxed);
+  if (!used.load(memory_order_relaxed)) {
+    used.store(true, memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief It adds a value to the histogram: the count and the buckets by 
+ * atomic adds, the sum and the extremes by compare and swap
+ * 
+ * @param value 
+ */
+void Metrics::Histogram::observe (double value) {
+  count.fetch_add(1, memory_order_relaxed);
+
+  double current = sum.load(memory_order_relaxed);
+  while (!sum.compare_exchange_weak(current, current + value, memory_order_relaxed));
+
+  current = lowest.load(memory_order_relaxed);
+  while (value < current && !lowest.compare_exchange_weak(current, value, memory_order_relaxed));
+
+  current = highest.load(memory_order_relaxed);
+  while (value > current && !highest.compare_exchange_weak(current, value, memory_order_relaxed));
+
+  int b = 0;
+  if (value > 0) {
+    b = max(1, min(BUCKETS - 1, ilogb(value) - MINEXP + 1));
+  }
+  buckets[b].fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * @brief It adds the values of another histogram, as observe() does for 
+ * one value
+ * 
+ * @param n 
+ * @param total 
+ * @param low 
+ * @param high 
+ * @param counts Of the BUCKETS buckets
+ */
+void Metrics::Histogram::merge (uint64_t n, double total, double low, double high,
+                                const uint64_t *counts) {
+  count.fetch_add(n, memory_order_relaxed);
+
+  double current = sum.load(memory_order_relaxed);
+  while (!sum.compare_exchange_weak(current, current + total, memory_order_relaxed));
+
+  current = lowest.load(memory_order_relaxed);
+  while (low < current && !lowest.compare_exchange_weak(current, low, memory_order_relaxed));
+
+  current = highest.load(memory_order_relaxed);
+  while (high > current && !highest.compare_exchange_weak(current, high, memory_order_relaxed));
+
+  for (int b = 0; b < BUCKETS; b++) {
+    buckets[b].fetch_add(counts[b], memory_order_relaxed);
+  }
+}
+
+void Metrics::Histogram::reset () {
+  count = 0;
+  sum = 0;
+  lowest = HUGE_VAL;
+  highest = -HUGE_VAL;
+  for (atomic<uint64_t> &bucket : buckets) {
+    bucket = 0;
+  }
+}
+
+/**
+ * @brief Handle of a counter, created at the first use of its name
+ * 
+ * @param name 
+ * @return Metrics::Counter& 
+ */
+Metrics::Counter &Metrics::counterOf (const string &name) {
+  lock_guard<mutex> guard(lock);
+  unique_ptr<Counter> &c = counters[name];
+  if (!c) {
+    c.reset(new Counter());
+  }
+  return *c;
+}
+
+/**
+ * @brief Handle of a histogram, created at the first use of its name
+ * 
+ * @param name 
+ * @return Metrics::Histogram& 
+ */
+Metrics::Histogram &Metrics::histogramOf (const string &name) {
+  lock_guard<mutex> guard(lock);
+  unique_ptr<Histogram> &h = histograms[name];
+  if (!h) {
+    h.reset(new Histogram());
+    h->reset();
+  }
+  return *h;
+}
+
+void Metrics::add (const string &name, uint64_t value) {
+  counterOf(name).add(value);
+}
+
+void Metrics::set (const string &name, double value) {
+  lock_guard<mutex> guard(lock);
+  gauges[name] = value;
+}
+
+void Metrics::observe (const string &name, double value) {
+  histogramOf(name).observe(value);
+}
+
+uint64_t Metrics::counter (const string &name) const {
+  lock_guard<mutex> guard(lock);
+  auto it = counters.find(name);
+  return it == counters.end() ? 0 : it->second->total.load();
+}
+
+double Metrics::gauge (const string &name) const {
+  lock_guard<mutex> guard(lock);
+  auto it = gauges.find(name);
+  return it == gauges.end() ? 0 : it->second;
+}
+
+/**
+ * @brief Mean of the values observed by a histogram
+ * 
+ * @param name 
+ * @return double 0 if there are none
+ */
+double Metrics::mean (const string &name) const {
+  lock_guard<mutex> guard(lock);
+  auto it = histograms.find(name);
+  if (it == histograms.end() || it->second->count == 0) return 0;
+  return it->second->sum / it->second->count;
+}
+
+/**
+ * @brief It empties the registry; the counters and histograms are reset
+ * in place, as their handles may be held
+ */
+void Metrics::clear () {
+  lock_guard<mutex> guard(lock);
+  for (auto &c : counters) {
+    c.second->total = 0;
+    c.second->used = false;
+  }
+  gauges.clear();
+  for (auto &h : histograms) {
+    h.second->reset();
+  }
+}
+
+/**
+ * @brief It appends the bytes of a value, or of a string after its length,
+ * to a snapshot
+ * 
+ * @param out 
+ * @param value 
+ */
+template <typename T>
+static void putValue (vector<uint8_t> &out, const T &value) {
+  const uint8_t *bytes = (const uint8_t *) &value;
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void putString (vector<uint8_t> &out, const string &s) {
+  putValue(out, (uint64_t) s.size());
+  out.insert(out.end(), s.begin(), s.end());
+}
+
+/**
+ * @brief It reads a value, or a string after its length, from a snapshot
+ * 
+ * @param data 
+ * @param len Bytes left, reduced by the ones read
+ * @param value 
+ * @return true 
+ * @return false If the snapshot is truncated
+ */
+template <typename T>
+static bool getValue (const uint8_t *&data, size_t &len, T &value) {
+  if (len < sizeof(T)) return false;
+
+  memcpy(&value, data, sizeof(T));
+  data += sizeof(T);
+  len -= sizeof(T);
+  return true;
+}
+
+static bool getString (const uint8_t *&data, size_t &len, string &s) {
+  uint64_t size;
+  if (!getValue(data, len, size) || len < size) return false;
+
+  s.assign((const char *) data, size);
+  data += size;
+  len -= size;
+  return true;
+}
+
+/**
+ * @brief Binary copy of the counters and histograms used, for merge() in
+ * the registry of another process on the same machine. The gauges are 
+ * left out, as they keep the last value only.
+ * 
+ * @return vector<uint8_t> 
+ */
+vector<uint8_t> Metrics::snapshot () const {
+  lock_guard<mutex> guard(lock);
+  vector<uint8_t> out;
+
+  uint64_t used = 0;
+  for (auto &c : counters) {
+    used += c.second->used;
+  }
+  putValue(out, used);
+  for (auto &c : counters) {
+    if (!c.second->used) continue;
+
+    putString(out, c.first);
+    putValue(out, c.second->total.load());
+  }
+
+  used = 0;
+  for (auto &h : histograms) {
+    used += h.second->count > 0;
+  }
+  putValue(out, used);
+  for (auto &h : histograms) {
+    const Histogram &histogram = *h.second;
+    if (histogram.count == 0) continue;
+
+    putString(out, h.first);
+    putValue(out, histogram.count.load());
+    putValue(out, histogram.sum.load());
+    putValue(out, histogram.lowest.load());
+    putValue(out, histogram.highest.load());
+    for (const atomic<uint64_t> &bucket : histogram.buckets) {
+      putValue(out, bucket.load());
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief It adds the counters and histograms of a snapshot to the ones of
+ * the same name, creating those missing
+ * 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false If the snapshot is truncated; what was read is merged
+ */
+bool Metrics::merge (const uint8_t *data, size_t len) {
+  uint64_t n;
+  if (!getValue(data, len, n)) return false;
+  for (uint64_t i = 0; i < n; i++) {
+    string name;
+    uint64_t total;
+    if (!getString(data, len, name) || !getValue(data, len, total)) return false;
+
+    counterOf(name).add(total);
+  }
+
+  if (!getValue(data, len, n)) return false;
+  for (uint64_t i = 0; i < n; i++) {
+    string name;
+    uint64_t count, buckets[Histogram::BUCKETS];
+    double sum, lowest, highest;
+    if (!getString(data, len, name) || !getValue(data, len, count) || 
+        !getValue(data, len, sum) || !getValue(data, len, lowest) || 
+        !getValue(data, len, highest) || !getValue(data, len, buckets)) {
+      return false;
+    }
+
+    histogramOf(name).merge(count, sum, lowest, highest, buckets);
+  }
+  return len == 0;
+}
+
+/**
+ * @brief JSON dump of all the metrics used; a bucket is named after its
+ * lower bound, 0 standing for the values not greater than zero
+ * 
+ * @return string 
+ */
+string Metrics::json () const {
+  lock_guard<mutex> guard(lock);
+  ostringstream out;
+  out << setprecision(17);
+
+  out << "{\n  \"counters\": {";
+  const char *sep = "";
+  for (auto &c : counters) {
+    if (!c.second->used) continue;
+
+    out << sep << "\n    \"" << c.first << "\": " << c.second->total;
+    sep = ",";
+  }
+
+  out << "\n  },\n  \"gauges\": {";
+  sep = "";
+  for (auto &g : gauges) {
+    out << sep << "\n    \"" << g.first << "\": " << g.second;
+    sep = ",";
+  }
+
+  out << "\n  },\n  \"histograms\": {";
+  sep = "";
+  for (auto &h : histograms) {
+    const Histogram &histogram = *h.second;
+    if (histogram.count == 0) continue;
+
+    out << sep << "\n    \"" << h.first << "\": {\"count\": " << histogram.count 
+        << ", \"sum\": " << histogram.sum << ", \"min\": " << histogram.lowest 
+        << ", \"max\": " << histogram.highest << ", \"buckets\": {";
+
+    const char *bsep = "";
+    for (int b = 0; b < Histogram::BUCKETS; b++) {
+      uint64_t n = histogram.buckets[b];
+      if (n == 0) continue;
+
+      double bound = b == 0 ? 0 : ldexp(1.0, b - 1 + Histogram::MINEXP);
+      out << bsep << "\"" << bound << "\": " << n;
+      bsep = ", ";
+    }
+    out << "}}";
+    sep = ",";
+  }
+  out << "\n  }\n}\n";
+  return out.str();
+}
+
+/**
+ * @brief Size of a file
+ * 
+ * @param filename 
+ * @return long Bytes, -1 if the file cannot be read
+ */
+long fileSize (const string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0 ? (long) st.st_size : -1;
+}
+
+/**
+ * @brief It writes all the bytes on a socket, without raising SIGPIPE 
+ * if the other end has gone
+ * 
+ * @param fd 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false 
+ */
+static bool sendAll (int fd, const void *data, size_t len) {
+  const char *bytes = (const char *) data;
+  while (len > 0) {
+    ssize_t n = send(fd, bytes, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief It reads exactly len bytes from a socket
+ * 
+ * @param fd 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false On error, or if the other end closes first
+ */
+static bool receiveAll (int fd, void *data, size_t len) {
+  char *bytes = (char *) data;
+  while (len > 0) {
+    ssize_t n = recv(fd, bytes, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief It sends a record on a stream socket: its id and length, then
+ * its bytes. A stream of records is closed by one of id ENDRECORD.
+ * 
+ * @param fd 
+ * @param id 
+ * @param data 
+ * @param len 
+ * @return true 
+ * @return false If the socket cannot be written
+ */
+bool sendRecord (int fd, uint64_t id, const uint8_t *data, size_t len) {
+  uint64_t header[2] = {id, (uint64_t) len};
+  if (!sendAll(fd, header, sizeof(header)) || !sendAll(fd, data, len)) {
+    cerr << "Could not send record " << id << ": " << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It receives a record sent by sendRecord
+ * 
+ * @param fd 
+ * @param id 
+ * @param data 
+ * @return true 
+ * @return false If the socket cannot be read, or it closes within a record
+ */
+bool receiveRecord (int fd, uint64_t &id, vector<uint8_t> &data) {
+  uint64_t header[2];
+  if (!receiveAll(fd, header, sizeof(header))) {
+    cerr << "Could not receive a record" << endl;
+    return false;
+  }
+
+  id = header[0];
+  data.resize(header[1]);
+  if (!receiveAll(fd, data.data(), data.size())) {
+    cerr << "Could not receive record " << id << endl;
+    return false;
+  }
+  return true;
+}
@@ -1,5 +1,8 @@
 #include <bits/stdc++.h>
 #include <execution>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 using namespace std;
 
 const string cryptoLocation = "/cryptocontext.txt";
@@ -7,17 +10,505 @@ const string keyPubLocation = "/key-public.txt";
 const string keyPriLocation = "/key-private.txt";
 const string keyMultLocation = "/key-eval-mult.txt";
 const string keyRotLocation = "/key-eval-rot.txt";
-
-string ciphertextName(int num);
-
-string aggregatorFileName(int num);
+const string keySumLocation = "/key-eval-sum.txt";
+const string keyManifestLocation = "/key-eval-manifest.txt";
+const string storeLocation = "/store-manifest.txt";
+const string cipherArchiveLocation = "/ciphertexts.arc";
+const string residueArchiveLocation = "/residues.arc";
+const string aggregatorArchiveLocation = "/aggregator.arc";
 
 void printVector (vector<int> v);
 
 vector<int> RNSBase (int low, int high);
 
+vector<int> RNSSymbolBase (int width, size_t redundant);
+
+size_t RNSSymbols (size_t len, int width);
+
 vector<int> RNS (int n, vector<int> base);
 
 int inv(int a, int m);
 
-int CRT(vector<int> base, vector<int> rem);
\ No newline at end of file
+uint64_t FNV1a (const uint8_t *data, size_t len, 
+                uint64_t hash = 14695981039346656037ULL);
+
+vector<uint32_t> RNSReciprocals (const vector<int> &base);
+
+void RNSEncodeBatch (const uint8_t *data, size_t len, int width, 
+                     const vector<int> &base, const vector<uint32_t> &recip, 
+                     uint8_t *residues);
+
+/**
+ * @brief Constants of the CRT reconstruction over a fixed base,
+ * computed once by CRTPrecompute and shared by every decoding
+ */
+struct CRTTable {
+  vector<int> base;
+  uint64_t M = 0;             // product of the moduli, 0 if it does not fit
+  double invM = 0;            // 1 / M, to estimate the final quotient
+  uint32_t recipM = 0;        // floor(2^32 / M), if M fits in 32 bits
+  vector<uint64_t> coeff;     // M_i * (M_i^-1 mod m_i), with M_i = M / m_i
+  bool narrow = false;        // whether the sum of the terms fits in 32 bits
+  bool wide = false;          // whether the sum of the terms may exceed 63 bits
+};
+
+CRTTable CRTPrecompute (const vector<int> &base);
+
+uint64_t CRTReconstruct (const CRTTable &t, const uint8_t *rem, size_t stride);
+
+bool CRTDecodeBatch (const CRTTable &t, const uint8_t *residues, size_t len,
+                     int width, uint8_t *out);
+
+uint64_t CRT(const vector<int> &base, const vector<int> &rem);
+
+/* Largest number of moduli of a RRNS base: the decoder takes the missing 
+ * residue planes as a 32-bit mask
+ */
+const size_t RRNSMAXMODULI = 32;
+
+/**
+ * @brief Redundant RNS decoder: the first legitimate moduli of the base 
+ * carry the value, the others are redundant and used to detect and 
+ * correct faulty residues
+ */
+struct RRNSDecoder {
+  vector<int> base;
+  size_t legitimate = 0;
+  int width = 1;              // bytes per encoded symbol
+  uint64_t limit = 0;         // every valid symbol is lower than limit
+  CRTTable primary;           // CRT over the legitimate moduli
+  CRTTable redundancy;        // CRT over the redundant moduli
+  CRTTable full;              // CRT over all the moduli, M = 0 if it does not fit
+};
+
+/**
+ * @brief Outcome of a RRNS decoding
+ */
+struct RRNSStats {
+  size_t corrected = 0;       // symbols rebuilt by discarding faulty residues
+  size_t uncorrectable = 0;   // symbols with more errors than correctable
+};
+
+RRNSDecoder RRNSPrecompute (const vector<int> &base, size_t legitimate, 
+                            int width);
+
+bool RRNSDecodeBatch (const RRNSDecoder &d, const uint8_t *residues, size_t len,
+                      uint32_t missing, uint8_t *out, RRNSStats &stats);
+
+vector<int> RNSBitWidths (const vector<int> &base);
+
+size_t RRNSPackedSize (const vector<int> &base, int width, size_t len);
+
+void RRNSPack (const vector<int> &base, int width, const uint8_t *residues, 
+               size_t len, vector<uint8_t> &packed);
+
+bool RRNSUnpack (const uint8_t *packed, size_t size, vector<int> &base,
+                 int &width, size_t &len, vector<uint8_t> &residues);
+
+/**
+ * @brief Streaming reader of a dataset of whitespace separated values:
+ * the file is read in blocks of fixed size and parsed without iostreams,
+ * handing out a chunk of values at a time
+ */
+class DatasetReader {
+public:
+  DatasetReader (const string &filename, size_t chunkSize);
+  ~DatasetReader ();
+
+  DatasetReader (const DatasetReader &) = delete;
+  DatasetReader &operator= (const DatasetReader &) = delete;
+
+  bool good () const;
+
+  bool next (vector<int64_t> &chunk);
+  bool next (vector<double> &chunk);
+
+private:
+  const char *token (size_t &len);
+  bool refill ();
+
+  template <typename T>
+  bool nextChunk (vector<T> &chunk);
+
+  int fd = -1;
+  size_t chunkSize;
+  vector<char> buffer;
+  size_t pos = 0;
+  size_t end = 0;
+  bool eof = false;
+  bool malformed = false;
+};
+
+/**
+ * @brief Read-only memory mapping of a whole file, unmapped when the 
+ * object is destroyed; its bytes are read through page faults instead 
+ * of being copied into a buffer
+ */
+class MappedFile {
+public:
+  MappedFile (const string &filename);
+  ~MappedFile ();
+
+  MappedFile (const MappedFile &) = delete;
+  MappedFile &operator= (const MappedFile &) = delete;
+
+  bool good () const;
+  const uint8_t *data () const;
+  size_t size () const;
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  bool valid = false;
+};
+
+/**
+ * @brief Asynchronous positional reads and writes, with a callback on the
+ * completion of each. With liburing (HAVE_LIBURING) the requests go to an
+ * io_uring and are reaped by a thread, otherwise a pool of I/O threads
+ * serves them with pread and pwrite. The callbacks run on a pool of 
+ * workers, so they can do the work the data is for. At most depth reads 
+ * and depth writes are in flight: a read keeps its slot until its callback
+ * returns, which bounds the data read ahead, a write only until it is done.
+ */
+class AsyncIO {
+public:
+  typedef function<void (bool ok, vector<uint8_t> &data)> Callback;
+
+  AsyncIO (int workers, size_t depth = 64);
+  ~AsyncIO ();
+
+  AsyncIO (const AsyncIO &) = delete;
+  AsyncIO &operator= (const AsyncIO &) = delete;
+
+  void read (int fd, uint64_t offset, size_t len, Callback done);
+  void write (int fd, vector<uint8_t> data, uint64_t offset, Callback done = nullptr);
+  void drain ();
+  const char *backend () const;
+
+private:
+  struct Request {
+    bool write = false;
+    int fd = -1;
+    uint64_t offset = 0;
+    vector<uint8_t> data;
+    size_t done = 0;          // bytes transferred so far
+    bool ok = true;
+    Callback callback;
+  };
+
+  void submit (Request *r);
+  void complete (Request *r);
+  void work ();
+  void serve ();
+  void reap ();
+
+  mutex lock;
+  condition_variable changed;
+  size_t depth;
+  size_t reads = 0;
+  size_t writes = 0;
+  size_t pending = 0;         // requests whose callback has not returned yet
+  deque<Request *> queue;     // requests for the I/O threads
+  deque<Request *> callbacks;
+  bool stopping = false;
+  vector<thread> workers;
+  vector<thread> servers;
+#ifdef HAVE_LIBURING
+  struct io_uring ring;
+  mutex ringLock;
+  bool ringReady = false;
+#endif
+};
+
+/**
+ * @brief Append-only archive of records, each identified by its id: a 
+ * header, the records back to back, then the index of the offset, length
+ * and checksum of every record. Records may be appended by several threads
+ * in any order; they are written in batches, and the index and header 
+ * only when the archive is closed.
+ */
+class ArchiveWriter {
+public:
+  ArchiveWriter (const string &filename, AsyncIO *io = nullptr, 
+                 size_t batchBytes = 8 << 20);
+  ~ArchiveWriter ();
+
+  ArchiveWriter (const ArchiveWriter &) = delete;
+  ArchiveWriter &operator= (const ArchiveWriter &) = delete;
+
+  bool good () const;
+  bool append (size_t id, const uint8_t *data, size_t len);
+  bool close ();
+
+private:
+  struct Entry {
+    uint64_t offset = 0;      // 0 for a missing record
+    uint64_t length = 0;
+    uint64_t checksum = 0;
+  };
+
+  bool write (const uint8_t *data, size_t len, uint64_t offset);
+
+  string filename;
+  int fd = -1;
+  AsyncIO *io;
+  size_t batch;
+  mutex lock;
+  condition_variable written;
+  size_t inFlight = 0;        // batches handed to io, not yet written
+  vector<uint8_t> pending;    // records not yet written, from pendingOffset
+  uint64_t pendingOffset = 0;
+  vector<Entry> index;
+  bool valid = false;
+};
+
+/**
+ * @brief Random access to the records of a closed archive, mapped in memory
+ */
+class ArchiveReader {
+public:
+  ArchiveReader (const string &filename);
+  ~ArchiveReader ();
+
+  ArchiveReader (const ArchiveReader &) = delete;
+  ArchiveReader &operator= (const ArchiveReader &) = delete;
+
+  bool good () const;
+  size_t size () const;
+  bool get (size_t id, const uint8_t *&data, size_t &len) const;
+  void readAsync (AsyncIO &io, size_t id, AsyncIO::Callback done) const;
+
+private:
+  bool entry (size_t id, uint64_t &offset, uint64_t &length, uint64_t &checksum) const;
+
+  MappedFile file;
+  int fd = -1;
+  string filename;
+  const uint8_t *index = nullptr;
+  size_t count = 0;
+  bool valid = false;
+};
+
+/**
+ * @brief Bounded lock-free queue for many producers and many consumers:
+ * every cell of the ring carries a sequence number, telling whether it is
+ * free for the producer or full for the consumer of the current lap, so 
+ * that both sides claim a cell with a single compare and swap.
+ * push waits while the queue is full, which holds back the producers of a
+ * stage to the pace of its consumers; pop waits while the queue is empty,
+ * until every producer has closed it.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+  BoundedQueue (size_t capacity, int producers = 1) : producers(producers) {
+    size_t n = 2;
+    while (n < capacity) n *= 2;
+
+    cells.reset(new Cell[n]);
+    mask = n - 1;
+    for (size_t i = 0; i < n; i++) {
+      cells[i].sequence.store(i, memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue (const BoundedQueue &) = delete;
+  BoundedQueue &operator= (const BoundedQueue &) = delete;
+
+  /**
+   * @brief It moves the item into the queue, unless it is full
+   */
+  bool tryPush (T &item) {
+    size_t pos = head.load(memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t sequence = cell.sequence.load(memory_order_acquire);
+      intptr_t lap = (intptr_t) sequence - (intptr_t) pos;
+
+      if (lap == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          cell.item = move(item);
+          cell.sequence.store(pos + 1, memory_order_release);
+          return true;
+        }
+      }
+      else if (lap < 0) {
+        return false;
+      }
+      else {
+        pos = head.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief It moves the oldest item out of the queue, unless it is empty
+   */
+  bool tryPop (T &item) {
+    size_t pos = tail.load(memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t sequence = cell.sequence.load(memory_order_acquire);
+      intptr_t lap = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+      if (lap == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          item = move(cell.item);
+          cell.sequence.store(pos + mask + 1, memory_order_release);
+          return true;
+        }
+      }
+      else if (lap < 0) {
+        return false;
+      }
+      else {
+        pos = tail.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  void push (T item) {
+    for (int spins = 0; !tryPush(item); spins++) {
+      backoff(spins);
+    }
+  }
+
+  /**
+   * @brief It waits for an item
+   * 
+   * @return false If the queue is empty and closed by all its producers
+   */
+  bool pop (T &item) {
+    for (int spins = 0; !tryPop(item); spins++) {
+      // Every push of the producers precedes their close
+      if (producers.load(memory_order_acquire) == 0) {
+        return tryPop(item);
+      }
+      backoff(spins);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Each producer closes the queue once, when it has no more items
+   */
+  void close () {
+    producers.fetch_sub(1, memory_order_release);
+  }
+
+  size_t capacity () const {
+    return mask + 1;
+  }
+
+private:
+  struct Cell {
+    atomic<size_t> sequence;
+    T item;
+  };
+
+  // It yields first, as the other side is usually about to move, then sleeps
+  static void backoff (int spins) {
+    if (spins < 64) {
+      this_thread::yield();
+    }
+    else {
+      this_thread::sleep_for(chrono::microseconds(50));
+    }
+  }
+
+  unique_ptr<Cell[]> cells;
+  size_t mask = 0;
+  char padHead[64];
+  atomic<size_t> head {0};     // next cell to fill
+  char padTail[64];
+  atomic<size_t> tail {0};     // next cell to empty
+  char padProducers[64];
+  atomic<int> producers;
+};
+
+/**
+ * @brief Summary of the samples of a benchmark, in seconds
+ */
+struct BenchStats {
+  double min = 0;
+  double median = 0;
+  double p99 = 0;
+};
+
+BenchStats benchSummary (vector<double> samples);
+
+/**
+ * @brief Thread-safe registry of the pipeline metrics, by name: counters
+ * accumulate, gauges keep the last value, histograms keep count, sum, 
+ * extremes and power of two buckets of the observed values.
+ * A counter or histogram can be resolved once by name into a handle, which
+ * the workers update with atomics only, without the lock of the registry;
+ * the handles stay valid as long as the registry, clear included.
+ * The counters and histograms of another process, such as a shard of the
+ * aggregator, are added by merging a snapshot of its registry.
+ */
+class Metrics {
+public:
+  class Counter {
+  public:
+    void add (uint64_t value = 1);
+
+  private:
+    friend class Metrics;
+    atomic<uint64_t> total {0};
+    atomic<bool> used {false};
+  };
+
+  class Histogram {
+  public:
+    void observe (double value);
+
+  private:
+    friend class Metrics;
+    void merge (uint64_t n, double total, double low, double high, const uint64_t *counts);
+    void reset ();
+
+    // Bucket 0 holds the values not greater than zero, bucket b > 0 those
+    // in [2^(b - 1 + MINEXP), 2^(b + MINEXP)), the extreme ones clamped
+    static const int MINEXP = -64;
+    static const int BUCKETS = 129;
+
+    atomic<uint64_t> count {0};
+    atomic<double> sum {0};
+    atomic<double> lowest {HUGE_VAL};
+    atomic<double> highest {-HUGE_VAL};
+    atomic<uint64_t> buckets[BUCKETS];
+  };
+
+  void add (const string &name, uint64_t value = 1);
+  void set (const string &name, double value);
+  void observe (const string &name, double value);
+
+  Counter &counterOf (const string &name);
+  Histogram &histogramOf (const string &name);
+
+  uint64_t counter (const string &name) const;
+  double gauge (const string &name) const;
+  double mean (const string &name) const;
+  string json () const;
+  void clear ();
+
+  vector<uint8_t> snapshot () const;
+  bool merge (const uint8_t *data, size_t len);
+
+private:
+  mutable mutex lock;
+  map<string, unique_ptr<Counter>> counters;
+  map<string, double> gauges;
+  map<string, unique_ptr<Histogram>> histograms;
+};
+
+long fileSize (const string &filename);
+
+// Id of the record closing a stream of records on a socket
+const uint64_t ENDRECORD = UINT64_MAX;
+
+bool sendRecord (int fd, uint64_t id, const uint8_t *data, size_t len);
+
+bool receiveRecord (int fd, uint64_t &id, vector<uint8_t> &data);
@@ -20,18 +20,84 @@
 
 // timing
 #include <chrono>
-#include <time.h>
+
+#include <omp.h>
+
+// shards of the aggregator
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace lbcrypto;
 
-#define SENDING     false
-#define AGGREGATOR  false
 
-#define WALLTIME    false
-#define CPUTIME     false
+// Number of threads of the parallel pipeline, all cores by default
+int numThreads = omp_get_max_threads();
+
+// Number of ciphers per partial sum at the aggregator, 0 for the total only
+int groupSize = 0;
+
+// Ciphers and residues are handed between the stages in memory, not on files
+bool INMEMORY = false;
+
+/* The stages run at the same time, connected by queues of queueDepth 
+ * packets, twice the threads if 0
+ */
+bool PIPELINE = false;
+size_t queueDepth = 0;
+
+/* The pipeline aggregator prints the sum of the last windowSize ciphers 
+ * arrived every windowSlide arrivals; 0 for no windows
+ */
+size_t windowSize = 0;
+size_t windowSlide = 0;
+
+// Processes of the sharded aggregator, 0 for the aggregator in process
+int shards = 0;
+
+// Number of values of the dataset in every cipher
+size_t chunkSize = 5000;
+
+// Every slot of the ring holds a value, and the total is obtained by EvalSum
+bool FULLSLOTS = false;
+
+// The decrypted aggregates are checked against plaintext reference sums
+bool VERIFY = false;
+
+// Counters, gauges and histograms of the run, dumped as JSON on metricsFile
+Metrics metrics;
+string metricsFile;
+
+/* The metrics updated for every chunk by the parallel stages, resolved once
+ * by name, so that the workers update them without the lock of the registry
+ */
+Metrics::Counter &chunksMetric = metrics.counterOf("chunks");
+Metrics::Counter &valuesMetric = metrics.counterOf("values");
+Metrics::Counter &cipherBytesMetric = metrics.counterOf("cipher_bytes");
+Metrics::Counter &rrnsInputMetric = metrics.counterOf("rrns_input_bytes");
+Metrics::Counter &rrnsSymbolsMetric = metrics.counterOf("rrns_symbols");
+Metrics::Counter &rrnsPackedMetric = metrics.counterOf("rrns_packed_bytes");
+Metrics::Counter &rrnsDecodedMetric = metrics.counterOf("rrns_decoded_bytes");
+Metrics::Counter &rrnsCorrectedMetric = metrics.counterOf("rrns_corrected_symbols");
+Metrics::Counter &rrnsUncorrectableMetric = metrics.counterOf("rrns_uncorrectable_symbols");
+Metrics::Histogram &cipherBytesHistogram = metrics.histogramOf("cipher_bytes");
+Metrics::Histogram &encryptHistogram = metrics.histogramOf("encrypt_seconds");
+Metrics::Histogram &encodeHistogram = metrics.histogramOf("rrns_encode_seconds");
+Metrics::Histogram &decodeHistogram = metrics.histogramOf("rrns_decode_seconds");
+Metrics::Histogram &aggregateAddHistogram = metrics.histogramOf("aggregate_add_seconds");
+
+/* Plaintext modulus of the slot encoding: a prime p = 1 mod 2^17, so 
+ * batching is possible up to ring dimension 2^16; being greater than 
+ * twice the total of the distances, the total does not wrap around.
+ */
+const int BATCHMODULUS = 269221889;
+uint32_t batchSize = 0;
 
-chrono::_V2::system_clock::time_point chronoBegin;
-clock_t start;
+// Parameters of the BGV context
+int PLAINTEXTMODULUS = 65537;
+uint32_t depth = 1;
+double sigma = 3.2;
+SecurityLevel securityLevel = HEStd_128_classic;
 
 // It takes the current directory
 // char buff[1024];
@@ -41,6 +107,9 @@ const string DATAFOLDER = "demoData";
 const string DISTANCEINT = "../../Data/dataInt.txt";
 const string AGGREGATORDATA = "aggregatorData";
 
+// Version of the layout of the context and key store
+const int STOREVERSION = 1;
+
 /* Representability: 7420738134810
  * Prime numbers between 0 and 20: {2, 3, 5, 7, 11, 13, 17, 19}
  * Four redundant residues {23, 29, 31, 37}
@@ -48,36 +117,102 @@ const string AGGREGATORDATA = "aggregatorData";
 // 0, 40 = 12 moduli
 // 0, 20 = 8 moduli
 // 0, 45 = 14 moduli
-const vector<int> base = RNSBase(0, 40);
+
+/* Number of cipher bytes encoded by every RNS symbol (1, 2, 3 or 4), 
+ * chosen with --symbol-width. Wider symbols use by default the smallest 
+ * primes covering 2^(8 * SYMBOLWIDTH) as legitimate moduli, plus REDUNDANT
+ * larger primes: 2 bytes = 11 moduli, 3 bytes = 13 moduli, 4 bytes = 14 moduli
+ */
+int SYMBOLWIDTH = 1;
+const size_t REDUNDANT = 4;
+
+vector<int> base = RNSBase(0, 40);
+
+// Barrett reciprocals of the base, used by the batch encoder
+vector<uint32_t> reciprocals = RNSReciprocals(base);
+
+// Number of legitimate moduli of the base, the others are redundant
+size_t LEGITIMATE = base.size() - REDUNDANT;
+
+// RRNS decoder of the base, used by the aggregator
+RRNSDecoder rrns = RRNSPrecompute(base, LEGITIMATE, SYMBOLWIDTH);
+
+// Towers of the ciphertext modulus left by the compression of the ciphers
+uint32_t towersLeft = 2;
 
 /**
- * @brief Additional function in order to measure execution times, both
- * wall and CPU time.
+ * @brief It installs a base as the RNS base of the RRNS stages, together 
+ * with its reciprocals and decoder, if its legitimate moduli cover a 
+ * symbol of SYMBOLWIDTH bytes and it has at most RRNSMAXMODULI moduli.
  * 
- * @param flag It decides whether it is the starting point (true), 
- * or the ending point (false)
+ * @param candidate 
+ * @return true 
+ * @return false If the legitimate moduli do not cover a symbol, or 
+ * they are too many
  */
-void timing (bool flag) { 
-  if (WALLTIME) {
-    if (flag) {
-      chronoBegin = chrono::high_resolution_clock::now();
-    }
-    else {
-      auto end = chrono::high_resolution_clock::now();
-      auto elapsed = chrono::duration_cast<chrono::nanoseconds>(end - chronoBegin);
-      printf("%.3f\n", elapsed.count() * 1e-9);
-    }
+bool installBase (const vector<int> &candidate) {
+  double range = 1;
+  for (size_t i = 0; i + REDUNDANT < candidate.size(); i++) {
+    range *= candidate[i];
+  }
+  if (candidate.size() <= REDUNDANT || candidate.size() > RRNSMAXMODULI ||
+      range < ldexp(1.0, 8 * SYMBOLWIDTH)) {
+    return false;
   }
 
-  if (CPUTIME) {
-    if (flag) {
-      start = clock();
-    }
-    else {
-      double elapsed = double(clock() - start) /CLOCKS_PER_SEC;
-      printf("%.3f\n", elapsed);
-    }
+  base = candidate;
+  reciprocals = RNSReciprocals(base);
+  LEGITIMATE = base.size() - REDUNDANT;
+  rrns = RRNSPrecompute(base, LEGITIMATE, SYMBOLWIDTH);
+  return true;
+}
+
+/**
+ * @brief It replaces the RNS base with the primes between low and high,
+ * which must leave, besides the REDUNDANT moduli, a range of at least 
+ * 256^SYMBOLWIDTH, and be at most RRNSMAXMODULI.
+ * 
+ * @param low 
+ * @param high 
+ * @return true 
+ * @return false If the legitimate moduli do not cover a symbol, or 
+ * they are too many
+ */
+bool setBase (int low, int high) {
+  vector<int> candidate = RNSBase(low, high);
+  if (candidate.size() > RRNSMAXMODULI) {
+    cerr << "The primes between " << low << " and " << high << " are more than the "
+         << RRNSMAXMODULI << " moduli of a base" << endl;
+    return false;
+  }
+
+  if (!installBase(candidate)) {
+    cerr << "The primes between " << low << " and " << high 
+         << " do not cover symbols of " << SYMBOLWIDTH << " bytes with " 
+         << REDUNDANT << " redundant moduli" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It sets the number of cipher bytes of every RNS symbol, and the 
+ * default base of that width: the primes below 40 for 1 byte, otherwise 
+ * the smallest primes covering the symbol.
+ * 
+ * @param width 1, 2, 3 or 4
+ * @return true 
+ * @return false If the width is not supported
+ */
+bool setSymbolWidth (int width) {
+  if (width < 1 || width > 4) {
+    cerr << "The symbol width must be 1, 2, 3 or 4 bytes" << endl;
+    return false;
   }
+
+  SYMBOLWIDTH = width;
+  return installBase(width == 1 ? RNSBase(0, 40) 
+                                : RNSSymbolBase(width, REDUNDANT));
 }
 
 /**
@@ -124,6 +259,72 @@ bool deserializeFromFile(const std::string& filename, T& obj,
   return true;
 }
 
+/**
+ * @brief Read-only stream buffer over bytes in memory, so that an object
+ * can be deserialised from memory without copying the bytes
+ */
+struct BufferStream : std::streambuf {
+  BufferStream (const uint8_t *data, size_t len) {
+    char *p = reinterpret_cast<char*>(const_cast<uint8_t*>(data));
+    setg(p, p, p + len);
+  }
+};
+
+/**
+ * @brief It allows the serialisation of an object of generic type T, 
+ * into a memory buffer
+ * 
+ * @tparam T 
+ * @param buffer 
+ * @param obj 
+ * @param sertype 
+ * @return true If writing was successful
+ * @return false In case of error in writing
+ */
+template <typename T>
+bool serializeToBuffer (vector<uint8_t> &buffer, const T& obj, 
+                        const SerType::SERBINARY& sertype) {
+  
+  ostringstream stream;
+  Serial::Serialize(obj, stream, sertype);
+  if (!stream) {
+    cerr << "Error writing serialization to memory" << endl;
+    return false;
+  }
+
+  const string bytes = stream.str();
+  buffer.assign(bytes.begin(), bytes.end());
+  return true;
+}
+
+/**
+ * @brief It allows the deserialisation of an object of generic type T, 
+ * from a memory buffer
+ * 
+ * @tparam T 
+ * @param data 
+ * @param len 
+ * @param obj 
+ * @param sertype 
+ * @return true If reading was successful
+ * @return false 
+ */
+template <typename T>
+bool deserializeFromBuffer (const uint8_t *data, size_t len, T& obj, 
+                            const SerType::SERBINARY& sertype) {
+  
+  BufferStream sb(data, len);
+  istream stream(&sb);
+  try {
+    Serial::Deserialize(obj, stream, sertype);
+  }
+  catch (const exception &e) {
+    cerr << "Could not read from memory: " << e.what() << endl;
+    return false;
+  }
+  return true;
+}
+
 /**
  * @brief Create the cryptocontext
  *
@@ -132,18 +333,35 @@ bool deserializeFromFile(const std::string& filename, T& obj,
  * m = 8192 cyclotomic order
  * @param sigma - distribution parameter for error distribution
  *
+ * With FULLSLOTS, the plaintext modulus is BATCHMODULUS, while batchSize 
+ * and chunkSize are set to all the slots of the ring.
+ * 
  * @return CryptoContext<DCRTPoly> 
  */
 CryptoContext<DCRTPoly> setup () {
-  int plaintextModulus = 65537;
-  double sigma = 3.2;
-  uint32_t depth = 1;
-  SecurityLevel securityLevel = HEStd_128_classic;
+  int plaintextModulus = FULLSLOTS ? BATCHMODULUS : PLAINTEXTMODULUS;
 
   CryptoContext<DCRTPoly> cc;
   cc = CryptoContextFactory<DCRTPoly>::genCryptoContextBGVrns(
           depth, plaintextModulus, securityLevel, sigma, depth, OPTIMIZED, BV);
 
+  /* The ring dimension is given by the modulus, the depth and the security
+   * level, so the context is generated again with a batch of ring dimension
+   */
+  if (FULLSLOTS) {
+    batchSize = cc->GetRingDimension();
+    if ((plaintextModulus - 1) % (2 * batchSize) != 0) {
+      cerr << "The plaintext modulus does not allow batching in ring dimension "
+           << batchSize << endl;
+      return 0;
+    }
+    chunkSize = batchSize;
+
+    cc = CryptoContextFactory<DCRTPoly>::genCryptoContextBGVrns(
+          depth, plaintextModulus, securityLevel, sigma, depth, OPTIMIZED, BV,
+          0, 0, 0, 0, 0, batchSize);
+  }
+
   cc->Enable(ENCRYPTION);
   cc->Enable(SHE);
   cc->Enable(LEVELEDSHE);
@@ -152,6 +370,134 @@ CryptoContext<DCRTPoly> setup () {
   return cc;
 }
 
+/**
+ * @brief Evaluation keys, as bits of a mask
+ */
+enum EvalKeys { MULTKEYS = 1, ROTATIONKEYS = 2, SUMKEYS = 4 };
+
+/**
+ * @brief The evaluation keys the aggregation actually needs: adding the 
+ * ciphers with EvalAdd needs none, the total in the slots by EvalSum 
+ * needs the summation keys
+ * 
+ * @return int Mask of EvalKeys
+ */
+int requiredKeys () {
+  return FULLSLOTS ? SUMKEYS : 0;
+}
+
+/**
+ * @brief Fingerprint of the serialised cryptocontext and key pair, 
+ * which identifies the context and keys the evaluation keys belong to
+ * 
+ * @param fingerprint 
+ * @return true 
+ * @return false If the files cannot be read
+ */
+bool keyFingerprint (uint64_t &fingerprint) {
+  MappedFile context(DATAFOLDER + cryptoLocation);
+  MappedFile publicKey(DATAFOLDER + keyPubLocation);
+  MappedFile secretKey(DATAFOLDER + keyPriLocation);
+  if (!context.good() || !publicKey.good() || !secretKey.good()) return false;
+
+  fingerprint = FNV1a(context.data(), context.size());
+  fingerprint = FNV1a(publicKey.data(), publicKey.size(), fingerprint);
+  fingerprint = FNV1a(secretKey.data(), secretKey.size(), fingerprint);
+  return true;
+}
+
+/**
+ * @brief The manifest records the fingerprint of the context and
+ * the evaluation keys serialised for it
+ * 
+ * @param fingerprint 
+ * @param keys Mask of EvalKeys
+ * @return true 
+ * @return false If there is no valid manifest
+ */
+bool readKeyManifest (uint64_t &fingerprint, int &keys) {
+  ifstream manifest(DATAFOLDER + keyManifestLocation);
+  return (bool) (manifest >> hex >> fingerprint >> dec >> keys);
+}
+
+bool writeKeyManifest (uint64_t fingerprint, int keys) {
+  ofstream manifest(DATAFOLDER + keyManifestLocation);
+  manifest << hex << fingerprint << dec << " " << keys << endl;
+  if (!manifest) {
+    cerr << "Error writing the key manifest" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It generates a kind of evaluation keys and serialises them
+ * 
+ * @param secretKey 
+ * @param cc 
+ * @param kind One of EvalKeys
+ * @return true If writing was successful
+ * @return false 
+ */
+bool serializeEvalKeys (LPPrivateKey<DCRTPoly> secretKey, CryptoContext<DCRTPoly> &cc,
+                        int kind) {
+  string location = kind == MULTKEYS ? keyMultLocation 
+                  : kind == SUMKEYS ? keySumLocation : keyRotLocation;
+
+  if (kind == MULTKEYS) {
+    cc->EvalMultKeyGen(secretKey);
+  }
+  else if (kind == SUMKEYS) {
+    cc->EvalSumKeyGen(secretKey);
+  }
+  else {
+    cc->EvalAtIndexKeyGen(secretKey, {1, 2, -1, -2});
+  }
+
+  ofstream keyfile(DATAFOLDER + location, ios::out | ios::binary);
+  if (!keyfile.is_open()) {
+    cerr << "Error serializing eval keys to " << location << endl;
+    return false;
+  }
+
+  bool written = kind == MULTKEYS ? cc->SerializeEvalMultKey(keyfile, SerType::BINARY)
+               : kind == SUMKEYS ? cc->SerializeEvalSumKey(keyfile, SerType::BINARY)
+               : cc->SerializeEvalAutomorphismKey(keyfile, SerType::BINARY);
+  if (!written) {
+    cerr << "Error writing serialization of the eval keys to " << location << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Only the evaluation keys required by the aggregation are 
+ * generated and serialised, and not even those if the manifest shows 
+ * they were already serialised for the same context and key pair
+ * 
+ * @param secretKey 
+ * @param cc 
+ * @return true If writing was successful
+ * @return false 
+ */
+bool serializeRequiredKeys (LPPrivateKey<DCRTPoly> secretKey, CryptoContext<DCRTPoly> &cc) {
+  uint64_t fingerprint, cached;
+  int keys = 0;
+  if (!keyFingerprint(fingerprint)) return false;
+  if (!readKeyManifest(cached, keys) || cached != fingerprint) {
+    keys = 0;
+  }
+
+  int missing = requiredKeys() & ~keys;
+  for (int kind : {MULTKEYS, ROTATIONKEYS, SUMKEYS}) {
+    if (missing & kind) {
+      if (!serializeEvalKeys(secretKey, cc, kind)) return false;
+    }
+  }
+
+  return missing == 0 || writeKeyManifest(fingerprint, keys | missing);
+}
+
 /**
  * @brief Taken a cryptocontext, serialises its keys to binary files
  * 
@@ -165,38 +511,77 @@ bool serializeKeys (LPKeyPair<DCRTPoly> keyPair, CryptoContext<DCRTPoly> &cc) {
  
   if (!serializeToFile(DATAFOLDER + keyPriLocation,keyPair.secretKey, SerType::BINARY)) return false;
 
-  cc->EvalMultKeyGen(keyPair.secretKey);
+  return serializeRequiredKeys(keyPair.secretKey, cc);
+}
 
-  ofstream emkeyfile(DATAFOLDER + keyMultLocation, ios::out | ios::binary);
-  if (emkeyfile.is_open()) {
-    if (cc->SerializeEvalMultKey(emkeyfile, SerType::BINARY) == false) {
-      cerr << "Error writing serialization of the eval mult keys to "
-                   "key-eval-mult.txt"
-                << endl;
-      return false;
-    }
-    emkeyfile.close();
-  } 
-  else {
-    cerr << "Error serializing eval mult keys" << endl;
+/**
+ * @brief Description of the parameters setup() generates the context with
+ * 
+ * @return string 
+ */
+string contextParameters () {
+  ostringstream parameters;
+  parameters << "BGVrns " << depth << " " << sigma << " " << (int) securityLevel 
+             << " " << (FULLSLOTS ? BATCHMODULUS : PLAINTEXTMODULUS);
+  return parameters.str();
+}
+
+/**
+ * @brief Persistent store of the cryptocontext and key pair: the manifest
+ * records the layout version, the parameters of the context and the 
+ * fingerprint of the serialised files. If all of them match, the store 
+ * is loaded instead of generating the context and keys again.
+ * 
+ * @param parameters Description of the context parameters
+ * @param cc 
+ * @param keyPair 
+ * @return true If the store was loaded
+ * @return false On a miss
+ */
+bool openStore (const string &parameters, CryptoContext<DCRTPoly> &cc, 
+                LPKeyPair<DCRTPoly> &keyPair) {
+  ifstream manifest(DATAFOLDER + storeLocation);
+  int version;
+  string stored;
+  uint64_t fingerprint, current;
+
+  if (!(manifest >> version) || version != STOREVERSION) return false;
+  manifest.ignore();
+  if (!getline(manifest, stored) || stored != parameters) return false;
+  if (!(manifest >> hex >> fingerprint)) return false;
+  if (!keyFingerprint(current) || current != fingerprint) return false;
+
+  if (!deserializeFromFile(DATAFOLDER + cryptoLocation, cc, SerType::BINARY) ||
+      !deserializeFromFile(DATAFOLDER + keyPubLocation, keyPair.publicKey, SerType::BINARY) ||
+      !deserializeFromFile(DATAFOLDER + keyPriLocation, keyPair.secretKey, SerType::BINARY)) {
     return false;
   }
 
-  // Generate the rotation evaluation keys
-  cc->EvalAtIndexKeyGen(keyPair.secretKey, {1, 2, -1, -2});
-  
-  ofstream erkeyfile(DATAFOLDER + keyRotLocation, ios::out | ios::binary);
-  if (erkeyfile.is_open()) {
-    if (cc->SerializeEvalAutomorphismKey(erkeyfile, SerType::BINARY) == false) {
-      cerr << "Error writing serialization of the eval rotation keys to "
-                   "key-eval-rot.txt"
-                << endl;
-      return false;
-    }
-    erkeyfile.close();
-  } 
-  else {
-    cerr << "Error serializing eval rotation keys" << endl;
+  // The batch is the one chosen by setup() when the store was generated
+  if (FULLSLOTS) {
+    batchSize = cc->GetEncodingParams()->GetBatchSize();
+    chunkSize = batchSize;
+  }
+  return true;
+}
+
+/**
+ * @brief It writes the manifest of the store, once the cryptocontext and 
+ * the keys have been serialised
+ * 
+ * @param parameters Description of the context parameters
+ * @return true If writing was successful
+ * @return false 
+ */
+bool closeStore (const string &parameters) {
+  uint64_t fingerprint;
+  if (!keyFingerprint(fingerprint)) return false;
+
+  ofstream manifest(DATAFOLDER + storeLocation);
+  manifest << STOREVERSION << "\n" << parameters << "\n" 
+           << hex << fingerprint << endl;
+  if (!manifest) {
+    cerr << "Error writing the store manifest" << endl;
     return false;
   }
   return true;
@@ -207,7 +592,7 @@ bool serializeKeys (LPKeyPair<DCRTPoly> keyPair, CryptoContext<DCRTPoly> &cc) {
  * 
  * @param cc 
  * @param location 
- * @param filter 
+ * @param filter One of EvalKeys
  * @return true If reading was successful
  * @return false 
  */
@@ -220,12 +605,18 @@ bool deserializeKeys (CryptoContext<DCRTPoly> &cc, string location,
     return false ;
   }
 
-  if (filter == 1) {
+  if (filter == MULTKEYS) {
     if (cc->DeserializeEvalMultKey(keys, SerType::BINARY) == false) {
       cerr << "Could not deserialize the mult key file" << endl;
       return false;
     }
   }
+  else if (filter == SUMKEYS) {
+    if (cc->DeserializeEvalSumKey(keys, SerType::BINARY) == false) {
+      cerr << "Could not deserialize the eval sum key file" << endl;
+      return false;
+    }
+  }
   else {
     if (cc->DeserializeEvalAutomorphismKey(keys, SerType::BINARY) == false) {
       cerr << "Could not deserialize the eval rotation key file"
@@ -236,6 +627,36 @@ bool deserializeKeys (CryptoContext<DCRTPoly> &cc, string location,
   return true;
 }
 
+/**
+ * @brief Aggregator side of the key manager: it loads only the evaluation 
+ * keys required by the aggregation, after checking in the manifest that 
+ * they belong to the serialised context and key pair
+ * 
+ * @param cc 
+ * @return true 
+ * @return false If a required key is missing or cannot be read
+ */
+bool loadKeys (CryptoContext<DCRTPoly> &cc) {
+  int required = requiredKeys();
+  if (required == 0) return true;
+
+  uint64_t fingerprint, cached;
+  int keys;
+  if (!keyFingerprint(fingerprint) || !readKeyManifest(cached, keys) 
+      || cached != fingerprint || (keys & required) != required) {
+    cerr << "The evaluation keys do not match the cryptocontext" << endl;
+    return false;
+  }
+
+  if ((required & MULTKEYS) && 
+      !deserializeKeys(cc, DATAFOLDER+keyMultLocation, MULTKEYS)) return false;
+  if ((required & ROTATIONKEYS) && 
+      !deserializeKeys(cc, DATAFOLDER+keyRotLocation, ROTATIONKEYS)) return false;
+  if ((required & SUMKEYS) && 
+      !deserializeKeys(cc, DATAFOLDER+keySumLocation, SUMKEYS)) return false;
+  return true;
+}
+
 /**
  * @brief Taken the input vector, it creates first the plaintext and then
  * it proceeds to encrypt it.
@@ -243,276 +664,1911 @@ bool deserializeKeys (CryptoContext<DCRTPoly> &cc, string location,
  * @param keyPair 
  * @param cc 
  * @param v 
- * @param filename 
  * @return Ciphertext<DCRTPoly> 
  */
-Ciphertext<DCRTPoly> makeCipher (LPKeyPair<DCRTPoly> keyPair, CryptoContext<DCRTPoly> &cc,
-                                vector<int64_t> v, string filename) {
+Ciphertext<DCRTPoly> encryptChunk (const LPKeyPair<DCRTPoly> &keyPair, 
+                                   CryptoContext<DCRTPoly> &cc, const vector<int64_t> &v) {
   
-  Plaintext plain = cc->MakeCoefPackedPlaintext(v);
-  auto cipher = cc->Encrypt(keyPair.publicKey, plain);
+  Plaintext plain = FULLSLOTS ? cc->MakePackedPlaintext(v) 
+                              : cc->MakeCoefPackedPlaintext(v);
+  return cc->Encrypt(keyPair.publicKey, plain);
+}
 
-  /* Reduces the size of ciphertext modulus to minimize the
-   * communication cost before sending the encrypted result for decryption
-   */
-  cipher = cc->Compress(cipher, 2U);
+/**
+ * @brief Reduces the size of ciphertext modulus to minimize the
+ * communication cost before sending the encrypted result for decryption
+ * 
+ * @param cc 
+ * @param cipher 
+ * @return Ciphertext<DCRTPoly> 
+ */
+Ciphertext<DCRTPoly> compressCipher (CryptoContext<DCRTPoly> &cc, 
+                                     const Ciphertext<DCRTPoly> &cipher) {
+  return cc->Compress(cipher, towersLeft);
+}
+
+/**
+ * @brief It encrypts the input vector, compresses the cipher and 
+ * serialises it into a buffer.
+ * 
+ * @param keyPair 
+ * @param cc 
+ * @param v 
+ * @param buffer 
+ * @return Ciphertext<DCRTPoly> 
+ */
+Ciphertext<DCRTPoly> makeCipher (const LPKeyPair<DCRTPoly> &keyPair, CryptoContext<DCRTPoly> &cc,
+                                const vector<int64_t> &v, vector<uint8_t> &buffer) {
+  
+  auto cipher = compressCipher(cc, encryptChunk(keyPair, cc, v));
 
-  if (!serializeToFile(DATAFOLDER + filename, cipher, SerType::BINARY)) {
+  if (!serializeToBuffer(buffer, cipher, SerType::BINARY)) {
     return 0;
   }
-
   return cipher;
 }
 
 /**
- * @brief Aggregator and server simulation: it deseralises the keys and cryptocontext, 
- * then it proceeds to sum between ciphers.
+ * @brief Parallel tree reduction of the ciphers: at every level the ciphers
+ * at distance stride are added in pairs, so that the total is obtained 
+ * after O(log n) levels of EvalAdd.
  * 
  * @param cc 
- * @param size 
- * @param FLAGRNS 
+ * @param ciphers At least one cipher; they are replaced by partial sums
+ * @return Ciphertext<DCRTPoly> 
  */
-void serverProcess(CryptoContext<DCRTPoly> &cc, int size, bool FLAGRNS) {
-
-  cc->ClearEvalMultKeys();
-  cc->ClearEvalAutomorphismKeys();
-  lbcrypto::CryptoContextFactory<lbcrypto::DCRTPoly>::ReleaseAllContexts();
-
-  // KEYS DESERIALIZATION //
-  CryptoContext<DCRTPoly> cc_ser;
-  if (!deserializeFromFile(DATAFOLDER + cryptoLocation, cc_ser, SerType::BINARY)) {
-    return;
-  }
-
-  LPPublicKey<DCRTPoly> pk;
-  if (!deserializeFromFile(DATAFOLDER + keyPubLocation, pk, SerType::BINARY)) {
-    return;
-  }
-
-  LPPrivateKey<DCRTPoly> sk;
-  if (!deserializeFromFile(DATAFOLDER + keyPriLocation, sk, SerType::BINARY)) {
-    return;
+Ciphertext<DCRTPoly> evalAddTree (CryptoContext<DCRTPoly> &cc, 
+                                  vector<Ciphertext<DCRTPoly>> &ciphers) {
+  long unsigned int n = ciphers.size();
+
+  for (long unsigned int stride = 1; stride < n; stride *= 2) {
+    #pragma omp parallel for num_threads(numThreads)
+    for (long unsigned int i = 0; i < n - stride; i += 2 * stride) {
+      ciphers[i] = cc->EvalAdd(ciphers[i], ciphers[i + stride]);
+    }
   }
+  return ciphers[0];
+}
 
-  if (!deserializeKeys(cc_ser, DATAFOLDER+keyMultLocation, 1)) return;
-  if (!deserializeKeys(cc_ser, DATAFOLDER+keyRotLocation, 2)) return;
+/**
+ * @brief Online aggregator of a stream of ciphers: it keeps the encrypted
+ * total of all the ciphers arrived so far and the sum of a window over the
+ * last window arrivals, moving by slide arrivals (tumbling if they are 
+ * equal), so that both can be decrypted at any moment.
+ * Every arrival costs a constant number of in-place additions, into buffers 
+ * allocated by the first ciphers and reused afterwards. A sliding window is
+ * split into panes of slide arrivals, each summed on its own: when a pane
+ * expires, its sum is subtracted from the window and its buffer takes the 
+ * pane that starts; this subtraction, once every slide arrivals, is the 
+ * only operation that allocates a cipher.
+ */
+class StreamAggregator {
+public:
+  StreamAggregator (const CryptoContext<DCRTPoly> &cc, size_t window = 0, 
+                    size_t slide = 0);
 
-  // CIPHERTEXTS DESERIALIZATION //
-  for (int i = 0; i < size-1; i+=2) { 
+  void add (ConstCiphertext<DCRTPoly> cipher);
 
-    Ciphertext<DCRTPoly> ct1, ct2;
-    if (FLAGRNS) {
-      if (!deserializeFromFile(AGGREGATORDATA + aggregatorFileName(i), ct1, SerType::BINARY)) {
-        return;
-      }
+  bool windowClosed () const;
+  size_t arrivals () const;
+  Ciphertext<DCRTPoly> total () const;
+  Ciphertext<DCRTPoly> windowSum () const;
 
-      if (!deserializeFromFile(AGGREGATORDATA + aggregatorFileName(i+1), ct2, SerType::BINARY)) {
-        return;
-      }
-    }
-    else {
-      if (!deserializeFromFile(DATAFOLDER + ciphertextName(i), ct1, SerType::BINARY)) {
-        return;
-      }
+private:
+  static void assign (Ciphertext<DCRTPoly> &buffer, ConstCiphertext<DCRTPoly> cipher);
 
-      if (!deserializeFromFile(DATAFOLDER + ciphertextName(i+1), ct2, SerType::BINARY)) {
-        return;
-      }
-    }
+  CryptoContext<DCRTPoly> cc;
+  size_t window;
+  size_t slide;
+  size_t count = 0;
+  Ciphertext<DCRTPoly> sum;
+  Ciphertext<DCRTPoly> windowed;
+  vector<Ciphertext<DCRTPoly>> panes;
+};
 
-    auto sum = cc_ser->EvalAdd(ct1, ct2);
-  
-    // Cloud Platform Side
-    Plaintext plainSum;
-    cc_ser->Decrypt(sk, sum, &plainSum);
+/**
+ * @brief It sets up the panes of a sliding window, which are allocated,
+ * like the total, by the first arrivals
+ * 
+ * @param cc 
+ * @param window Number of arrivals in a window, 0 for the total only
+ * @param slide Arrivals between two windows, a divisor of window; 0 for 
+ * tumbling windows
+ */
+StreamAggregator::StreamAggregator (const CryptoContext<DCRTPoly> &cc, size_t window,
+                                    size_t slide) 
+  : cc(cc), window(window), slide(slide > 0 ? slide : window) {
 
-    cout << "\n > Results Palisade\n" 
-        << "Sum: " << plainSum << endl;
+  if (window > 0 && window / this->slide > 1) {
+    panes.resize(window / this->slide);
   }
-
-  if (AGGREGATOR) {
-    timing (false);
-  } 
 }
 
 /**
- * @brief Reading the binary file into a INT vectors
+ * @brief It copies the cipher into the buffer, allocating it only the 
+ * first time
  * 
- * @param filename 
- * @return vector<uint8_t> 
+ * @param buffer 
+ * @param cipher 
  */
-vector<uint8_t> readCiphers (string filename) {
-  ifstream file;
-  
-  file.open(filename,  ios::in | ios::binary);
-  file.seekg(0, ios::end);
-  size_t filesize = file.tellg();
-  file.seekg(0, ios::beg);
-
-  vector<uint8_t> vec(filesize/sizeof(uint8_t));
-  file.read(reinterpret_cast<char*>(vec.data()), filesize); 
-  file.close();
-
-  return vec;
+void StreamAggregator::assign (Ciphertext<DCRTPoly> &buffer, 
+                               ConstCiphertext<DCRTPoly> cipher) {
+  if (buffer) {
+    *buffer = *cipher;
+  }
+  else {
+    buffer = make_shared<CiphertextImpl<DCRTPoly>>(*cipher);
+  }
 }
 
 /**
- * @brief It writes a vector of char into a binary file
+ * @brief It folds an arriving cipher into the total and the window
  * 
- * @param v 
+ * @param cipher 
+ */
+void StreamAggregator::add (ConstCiphertext<DCRTPoly> cipher) {
+  if (count == 0) {
+    assign(sum, cipher);
+  }
+  else {
+    cc->EvalAddInPlace(sum, cipher);
+  }
+
+  if (window > 0 && panes.empty()) {
+    // A tumbling window starts again every window arrivals
+    if (count % window == 0) {
+      assign(windowed, cipher);
+    }
+    else {
+      cc->EvalAddInPlace(windowed, cipher);
+    }
+  }
+  else if (window > 0) {
+    Ciphertext<DCRTPoly> &pane = panes[count / slide % panes.size()];
+
+    // The pane starting now takes the buffer of the one leaving the window
+    if (count % slide == 0) {
+      if (count >= window) {
+        windowed = cc->EvalSub(windowed, pane);
+      }
+      assign(pane, cipher);
+    }
+    else {
+      cc->EvalAddInPlace(pane, cipher);
+    }
+
+    if (count == 0) {
+      assign(windowed, cipher);
+    }
+    else {
+      cc->EvalAddInPlace(windowed, cipher);
+    }
+  }
+  count++;
+}
+
+/**
+ * @brief Whether the last arrival has completed a window
+ * 
+ * @return true 
+ * @return false 
+ */
+bool StreamAggregator::windowClosed () const {
+  return window > 0 && count >= window && count % slide == 0;
+}
+
+size_t StreamAggregator::arrivals () const {
+  return count;
+}
+
+Ciphertext<DCRTPoly> StreamAggregator::total () const {
+  return sum;
+}
+
+/**
+ * @brief Sum of the arrivals since the start of the oldest pane of the 
+ * window: the last window arrivals, when a window has just closed
+ * 
+ * @return Ciphertext<DCRTPoly> 
+ */
+Ciphertext<DCRTPoly> StreamAggregator::windowSum () const {
+  return windowed;
+}
+
+/**
+ * @brief Seconds elapsed since begin
+ * 
+ * @param begin 
+ * @return double 
+ */
+double elapsed (chrono::steady_clock::time_point begin) {
+  return chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+/**
+ * @brief It adds a batch of chunks to the plaintext reference sums, slot
+ * by slot; every group of ciphers has its own reference
+ * 
+ * @param reference 
+ * @param chunks 
+ * @param batch Number of chunks of the batch
+ * @param first Index of the cipher of the first chunk
+ */
+void addReference (vector<vector<int64_t>> &reference, const vector<vector<int64_t>> &chunks,
+                   long unsigned int batch, long unsigned int first) {
+  for (long unsigned int j = 0; j < batch; j++) {
+    long unsigned int g = groupSize > 0 ? (first + j) / groupSize : 0;
+    if (reference.size() <= g) {
+      reference.resize(g + 1);
+    }
+
+    vector<int64_t> &sum = reference[g];
+    const vector<int64_t> &chunk = chunks[j];
+    if (sum.size() < chunk.size()) {
+      sum.resize(chunk.size(), 0);
+    }
+
+    #pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (size_t s = 0; s < chunk.size(); s++) {
+      sum[s] += chunk[s];
+    }
+  }
+}
+
+/**
+ * @brief It checks a decrypted aggregate against the plaintext reference 
+ * sum of the same values: every slot, or the total left in slot 0 by 
+ * EvalSum, must be congruent to it modulo the plaintext modulus
+ * 
+ * @param plain 
+ * @param reference Sums of the values, slot by slot
+ * @param name The aggregate, for the report
+ * @return true If they match
+ */
+bool checkAggregate (const Plaintext &plain, const vector<int64_t> &reference, 
+                     const string &name) {
+  int64_t modulus = FULLSLOTS ? BATCHMODULUS : PLAINTEXTMODULUS;
+  vector<int64_t> expected = reference;
+  if (FULLSLOTS) {
+    expected.assign(1, accumulate(reference.begin(), reference.end(), (int64_t) 0));
+  }
+
+  const vector<int64_t> &decrypted = FULLSLOTS ? plain->GetPackedValue() 
+                                               : plain->GetCoefPackedValue();
+  size_t mismatches = 0;
+
+  #pragma omp parallel for num_threads(numThreads) reduction(+:mismatches)
+  for (size_t s = 0; s < expected.size(); s++) {
+    int64_t value = s < decrypted.size() ? decrypted[s] : 0;
+    if ((value - expected[s]) % modulus != 0) mismatches++;
+  }
+
+  metrics.add("check_mismatches", mismatches);
+  if (mismatches > 0) {
+    cerr << "Check of " << name << ": " << mismatches << " of " << expected.size()
+         << " slots differ from the reference" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief It deserialises the cryptocontext and the evaluation keys, all 
+ * that is needed to add the ciphers, but not to decrypt them
+ * 
+ * @param cc_ser The deserialised cryptocontext
+ * @return true 
+ * @return false If they cannot be loaded
+ */
+bool loadAggregator (CryptoContext<DCRTPoly> &cc_ser) {
+  if (!deserializeFromFile(DATAFOLDER + cryptoLocation, cc_ser, SerType::BINARY)) {
+    return false;
+  }
+  return loadKeys(cc_ser);
+}
+
+/**
+ * @brief Aggregator side of the keys: it releases the cryptocontext of 
+ * the encryption, then deseralises the cryptocontext, the secret key and
+ * the evaluation keys from their files, as a separate aggregator would
+ * 
+ * @param cc 
+ * @param cc_ser The deserialised cryptocontext
+ * @param sk 
+ * @return true 
+ * @return false If the keys cannot be loaded
+ */
+bool openAggregator (CryptoContext<DCRTPoly> &cc, CryptoContext<DCRTPoly> &cc_ser,
+                     LPPrivateKey<DCRTPoly> &sk) {
+
+  cc->ClearEvalMultKeys();
+  cc->ClearEvalAutomorphismKeys();
+  cc->ClearEvalSumKeys();
+  lbcrypto::CryptoContextFactory<lbcrypto::DCRTPoly>::ReleaseAllContexts();
+
+  // KEYS DESERIALIZATION //
+  if (!loadAggregator(cc_ser)) return false;
+
+  LPPublicKey<DCRTPoly> pk;
+  if (!deserializeFromFile(DATAFOLDER + keyPubLocation, pk, SerType::BINARY)) {
+    return false;
+  }
+
+  return deserializeFromFile(DATAFOLDER + keyPriLocation, sk, SerType::BINARY);
+}
+
+/**
+ * @brief It decrypts the partial sums of the groups, if groupSize is set,
+ * then adds the partials into the total and decrypts it, checking every
+ * aggregate against its reference when VERIFY
+ * 
+ * @param cc_ser 
+ * @param sk 
+ * @param size Number of ciphers aggregated, for the metrics
+ * @param partials The sums of the groups if groupSize is set, otherwise
+ * the total; they are added into the total in place
+ * @param reference Plaintext sums of every group when VERIFY, otherwise empty
+ * @param begin Start of the aggregation, for its metric
+ * @return true 
+ * @return false If an aggregate does not match its reference
+ */
+bool decryptAggregate (CryptoContext<DCRTPoly> &cc_ser, const LPPrivateKey<DCRTPoly> &sk,
+                       int size, vector<Ciphertext<DCRTPoly>> &partials,
+                       const vector<vector<int64_t>> &reference, 
+                       chrono::steady_clock::time_point begin) {
+  metrics.add("ciphers_aggregated", size);
+
+  bool verified = true;
+  if (groupSize > 0) {
+    for (int g = 0; g < (int) partials.size(); g++) {
+      Plaintext plainPartial;
+      if (FULLSLOTS) {
+        cc_ser->Decrypt(sk, cc_ser->EvalSum(partials[g], batchSize), &plainPartial);
+        if (VERIFY && !checkAggregate(plainPartial, reference[g], "group " + to_string(g))) {
+          verified = false;
+        }
+        plainPartial->SetLength(1);
+      }
+      else {
+        cc_ser->Decrypt(sk, partials[g], &plainPartial);
+        if (VERIFY && !checkAggregate(plainPartial, reference[g], "group " + to_string(g))) {
+          verified = false;
+        }
+      }
+
+      cout << "\n > Partial sum of group " << g << "\n" 
+           << "Sum: " << plainPartial << endl;
+    }
+  }
+
+  auto sum = evalAddTree(cc_ser, partials);
+
+  /* The slots are added by log2(batchSize) rotations, leaving the total
+   * in every slot; a single EvalSum on the aggregate suffices, as it is linear
+   */
+  if (FULLSLOTS) {
+    sum = cc_ser->EvalSum(sum, batchSize);
+  }
+  
+  metrics.set("aggregate_seconds", 
+              chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+
+  // Cloud Platform Side
+  begin = chrono::steady_clock::now();
+  Plaintext plainSum;
+  cc_ser->Decrypt(sk, sum, &plainSum);
+  metrics.set("decrypt_seconds", 
+              chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+
+  // The reference of the total is the sum of the ones of the groups
+  vector<int64_t> expected;
+  if (VERIFY) {
+    for (const vector<int64_t> &group : reference) {
+      expected.resize(max(expected.size(), group.size()), 0);
+      for (size_t s = 0; s < group.size(); s++) {
+        expected[s] += group[s];
+      }
+    }
+    if (!checkAggregate(plainSum, expected, "the total")) {
+      verified = false;
+    }
+  }
+
+  int64_t total = 0;
+  if (FULLSLOTS) {
+    total = plainSum->GetPackedValue()[0];
+    plainSum->SetLength(1);
+  }
+  else {
+    for (int64_t x : plainSum->GetCoefPackedValue()) {
+      total += x;
+    }
+  }
+
+  cout << "\n > Results Palisade\n" 
+      << "Sum: " << plainSum << "\n"
+      << "Total: " << total << endl;
+
+  if (VERIFY) {
+    // The slots match modulo p, the total must also not wrap around it
+    int64_t reference = accumulate(expected.begin(), expected.end(), (int64_t) 0);
+    if (total != reference) {
+      cerr << "The total differs from the reference " << reference << endl;
+      verified = false;
+    }
+    cout << "Check: " << (verified ? "exact" : "FAILED") << endl;
+  }
+  return verified;
+}
+
+/**
+ * @brief It adds a batch of consecutive ciphers to the sums of their 
+ * groups, or to the total if groupSize is not set. The ciphers of every
+ * group in the batch are moved out of it and added by evalAddTree, then
+ * their sum is added in place to the one of the group, which starts from
+ * it in the first batch of the group.
+ * 
+ * @param cc_ser 
+ * @param batch Emptied
+ * @param first Index of the first cipher of the batch
+ * @param sums 
+ */
+void addBatch (CryptoContext<DCRTPoly> &cc_ser, vector<Ciphertext<DCRTPoly>> &batch,
+               long unsigned int first, vector<Ciphertext<DCRTPoly>> &sums) {
+  long unsigned int j = 0;
+  while (j < batch.size()) {
+    long unsigned int g = groupSize > 0 ? (first + j) / groupSize : 0;
+    long unsigned int end = groupSize > 0 ? min(batch.size(), (g + 1) * groupSize - first)
+                                          : batch.size();
+    vector<Ciphertext<DCRTPoly>> group(make_move_iterator(batch.begin() + j),
+                                       make_move_iterator(batch.begin() + end));
+    auto sum = evalAddTree(cc_ser, group);
+
+    if (sums.size() <= g) {
+      sums.resize(g + 1);
+    }
+    if (sums[g]) {
+      cc_ser->EvalAddInPlace(sums[g], sum);
+    }
+    else {
+      sums[g] = sum;
+    }
+    j = end;
+  }
+  batch.clear();
+}
+
+/**
+ * @brief Aggregator and server simulation: it deseralises the keys and cryptocontext, 
+ * then it proceeds to sum all the ciphers of the archive into a single 
+ * encrypted total, decrypted once at the end. If groupSize is set, the 
+ * partial sums of every group of ciphers are decrypted as well.
+ * The keys and the cryptocontext are loaded synchronously; the ciphers of
+ * the archive are read ahead through the asynchronous I/O, at most 
+ * queueDepth at a time, and every batch of queueDepth ciphers is added to
+ * the sums as soon as it is read, so only the sums and two batches are kept.
+ * 
+ * @param cc 
+ * @param size 
+ * @param FLAGRNS 
+ * @param reference Plaintext sums of every group when VERIFY, otherwise empty
+ * @param io The asynchronous I/O of the archives
+ * @return true 
+ * @return false If the keys or the ciphers cannot be loaded, or an 
+ * aggregate does not match its reference
+ */
+bool serverProcess(CryptoContext<DCRTPoly> &cc, int size, bool FLAGRNS,
+                   const vector<vector<int64_t>> &reference, AsyncIO &io) {
+
+  CryptoContext<DCRTPoly> cc_ser;
+  LPPrivateKey<DCRTPoly> sk;
+  if (!openAggregator(cc, cc_ser, sk)) return false;
+
+  if (size == 0) return true;
+  ArchiveReader archive(FLAGRNS ? AGGREGATORDATA + aggregatorArchiveLocation 
+                                : DATAFOLDER + cipherArchiveLocation);
+  if (!archive.good()) return false;
+
+  /* Cipher i is read into slot i % ahead, which the read of cipher 
+   * i + ahead takes once it has been deserialized
+   */
+  const int ahead = min(size, (int) (queueDepth > 0 ? queueDepth : 2 * numThreads));
+  vector<vector<uint8_t>> slots(ahead);
+  vector<int> state(ahead, 0);      // 0 in flight, 1 read, -1 failed
+  mutex lock;
+  condition_variable arrived;
+
+  auto readAhead = [&](int i) {
+    int slot = i % ahead;
+    {
+      lock_guard<mutex> guard(lock);
+      state[slot] = 0;
+    }
+    archive.readAsync(io, i, [&, slot](bool ok, vector<uint8_t> &data) {
+      {
+        lock_guard<mutex> guard(lock);
+        slots[slot].swap(data);
+        state[slot] = ok ? 1 : -1;
+      }
+      arrived.notify_all();
+    });
+  };
+
+  for (int i = 0; i < ahead; i++) {
+    readAhead(i);
+  }
+
+  // AGGREGATION //
+  vector<Ciphertext<DCRTPoly>> sums, batch;
+  chrono::steady_clock::duration adding(0);
+  bool failed = false;
+  for (int i = 0; i < size && !failed; i++) {
+    vector<uint8_t> record;
+    {
+      unique_lock<mutex> guard(lock);
+      arrived.wait(guard, [&]() { return state[i % ahead] != 0; });
+      failed = state[i % ahead] < 0;
+      record.swap(slots[i % ahead]);
+    }
+    if (failed) break;
+    if (i + ahead < size) {
+      readAhead(i + ahead);
+    }
+
+    /* Deserializing stays sequential: it registers the cryptocontext of 
+     * the cipher in the PALISADE factory, which is not thread safe.
+     */
+    batch.emplace_back();
+    failed = !deserializeFromBuffer(record.data(), record.size(), batch.back(), 
+                                    SerType::BINARY);
+
+    if (!failed && (batch.size() == (size_t) ahead || i == size - 1)) {
+      auto begin = chrono::steady_clock::now();
+      addBatch(cc_ser, batch, i + 1 - batch.size(), sums);
+      adding += chrono::steady_clock::now() - begin;
+    }
+  }
+
+  // No read may still refer to the slots
+  io.drain();
+  if (failed) return false;
+
+  // The additions done as the ciphers were read count as aggregation
+  return decryptAggregate(cc_ser, sk, size, sums, reference, 
+                          chrono::steady_clock::now() - adding);
+}
+
+/**
+ * @brief It closes an archive, writing its index
+ * 
+ * @param archive 
  * @param filename 
+ * @return true 
+ * @return false 
  */
-void writeAggregation (vector<uint8_t> v, string filename) {
-  ofstream fout(filename, ios::out | ios::binary);
-  fout.write((char*)&v[0], v.size() * sizeof(uint8_t));
-  fout.close();
+bool closeArchive (ArchiveWriter &archive, const string &filename) {
+  if (!archive.close()) return false;
+
+  metrics.add("bytes_written", max(0L, fileSize(filename)));
+  return true;
 }
 
 /**
- * @brief RRNS encoding procedure. It transforms the contents of 
- * the cipher files into 8-bit int, then proceeds to encode 
- * each of these integers.
+ * @brief RRNS encoding procedure. It transforms the bytes of a 
+ * serialised cipher into integers of SYMBOLWIDTH bytes, then proceeds 
+ * to encode all of these integers in a single batch.
  * 
- * @param i 
- * @return vector<vector<int>> 
+ * @param cipher The serialised cipher, in memory or mapped from its file
+ * @param len 
+ * @return vector<uint8_t> The residues in the packed wire format
  */
-vector<vector<int>> encoding (long unsigned int i) {
-  vector<vector<int>> residues;
-  vector<uint8_t> vplain = readCiphers(DATAFOLDER+ciphertextName(i));
+vector<uint8_t> encoding (const uint8_t *cipher, size_t len) {
+  vector<uint8_t> residues(RNSSymbols(len, SYMBOLWIDTH) * base.size());
 
   // RNS encoding
-  for (long unsigned int i = 0; i < vplain.size(); i++) {
-    vector<int> ri = RNS(vplain[i], base);
-    residues.push_back(ri);
-  }
+  RNSEncodeBatch(cipher, len, SYMBOLWIDTH, base, reciprocals, residues.data());
+
+  vector<uint8_t> packed;
+  RRNSPack(base, SYMBOLWIDTH, residues.data(), len, packed);
 
-  return residues;
+  rrnsInputMetric.add(len);
+  rrnsSymbolsMetric.add(RNSSymbols(len, SYMBOLWIDTH));
+  rrnsPackedMetric.add(packed.size());
+  return packed;
 }
 
 /**
  * @brief RRNS decoding procedure; it returns a int vector representing
  * a single integer representation of a cipher.
+ * Faulty residues are detected through the redundant moduli and, if they
+ * are no more than half of the redundancy, corrected.
  * 
- * @param dataset 
- * @return vector<vector<uint8_t>> 
+ * @param packed The residues in the packed wire format, in memory or 
+ * mapped from their file
+ * @param size 
+ * @param i 
+ * @return vector<uint8_t> Empty in case of error
  */
-vector<vector<uint8_t>> decoding (map<int, vector<vector<int>>> dataset) {
-  vector<vector<uint8_t>> dataset_decoding;
-  vector<uint8_t> chuck_decoding;
+vector<uint8_t> decoding (const uint8_t *packed, size_t size, long unsigned int i) {
+  vector<int> received;
+  int width;
+  size_t len;
+  vector<uint8_t> residues;
+
+  if (!RRNSUnpack(packed, size, received, width, len, residues)) {
+    cerr << "Could not unpack the residues of cipher " << i << endl;
+    return vector<uint8_t>();
+  }
 
-  map<int, vector<vector<int>>>::iterator it;
-  for (it = dataset.begin(); it != dataset.end(); it++) {
-    for (long unsigned int i = 0; i < it->second.size(); i++) {
-      int tmp = CRT(base, it->second[i]);
-      chuck_decoding.push_back(tmp);
-    }
-    
-    dataset_decoding.push_back(chuck_decoding);
-    chuck_decoding.clear();
+  if (received != base || width != SYMBOLWIDTH) {
+    cerr << "The residues of cipher " << i << " use another RNS base" << endl;
+    return vector<uint8_t>();
   }
-  return dataset_decoding;
+
+  vector<uint8_t> chuck_decoding(len);
+  RRNSStats stats;
+
+  if (!RRNSDecodeBatch(rrns, residues.data(), chuck_decoding.size(), 0,
+                       chuck_decoding.data(), stats)) {
+    cerr << "Could not decode the residues of cipher " << i << endl;
+    return vector<uint8_t>();
+  }
+
+  rrnsDecodedMetric.add(len);
+  rrnsCorrectedMetric.add(stats.corrected);
+  rrnsUncorrectableMetric.add(stats.uncorrectable);
+
+  if (stats.corrected > 0) {
+    cerr << "Corrected " << stats.corrected << " symbols of cipher " 
+         << i << endl;
+  }
+
+  if (stats.uncorrectable > 0) {
+    cerr << "Too many faulty residues in " << stats.uncorrectable 
+         << " symbols of cipher " << i << endl;
+    return vector<uint8_t>();
+  }
+  return chuck_decoding;
 }
 
 /**
- * @brief It applies palisade encryption to incoming data
+ * @brief It applies palisade encryption to incoming data.
+ * Chunks are independent, so each stage runs in parallel over them
+ * on numThreads threads.
+ * 
+ * When INMEMORY, the serialised ciphers and their residues are passed
+ * between the stages in memory buffers, without touching the files: every
+ * batch of numThreads chunks is encrypted, encoded and decoded, then added
+ * to the sums before the next one is read, so only a batch of ciphers is
+ * kept. Otherwise every stage appends its output to a single archive, and 
+ * the archives are written and read through the asynchronous I/O, so that
+ * the disk works while the ciphers are encrypted and decoded.
  * 
  * @param cc 
- * @param v 
+ * @param keyPair 
+ * @param reader The dataset, read a chunk at a time
  * @param FLAGRNS It indicates whether or not apply the RRNS encoding
+ * @return true 
+ * @return false If a stage failed
  */
-void palisade (CryptoContext<DCRTPoly> &cc, vector<vector<int64_t>> v,
-              bool FLAGRNS) {
-  
-  LPKeyPair<DCRTPoly> keyPair = cc->KeyGen();
-  if (!serializeKeys(keyPair, cc)) return;
+bool palisade (CryptoContext<DCRTPoly> &cc, const LPKeyPair<DCRTPoly> &keyPair,
+              DatasetReader &reader, bool FLAGRNS) {
 
-  // Creates and serializes the ciphers
-  for (long unsigned int i = 0; i < v.size(); i++) {
-    makeCipher(keyPair, cc, v[i], ciphertextName(i));
-  }
+  bool failed = false;
+  vector<vector<int64_t>> reference;
+  long unsigned int size = 0;
+
+  // In memory, the aggregator has its keys before the first batch
+  CryptoContext<DCRTPoly> cc_ser;
+  LPPrivateKey<DCRTPoly> sk;
+  vector<Ciphertext<DCRTPoly>> sums;
+  chrono::steady_clock::duration adding(0);
+  if (INMEMORY && !openAggregator(cc, cc_ser, sk)) return false;
 
   /* --- SENDING ---
-   * If the RNS encoding is active,
+   * Creates and serializes the ciphers. If the RNS encoding is active,
    * before sending, the data must be reduced to its residues.
+   * The dataset is streamed: only numThreads chunks at a time are
+   * read, then encrypted in parallel.
    */
-  if (FLAGRNS) {   
-    map<int, vector<vector<int>>> dataset;
-  
-    // ENCODING FOR SENDING // 
-    for (long unsigned int i = 0; i < v.size(); i++) {
-      vector<vector<int>> residues = encoding (i);
-      dataset.insert(make_pair(i, residues));
+  // The archives are destroyed first, as their writes may be in flight
+  unique_ptr<AsyncIO> io;
+  unique_ptr<ArchiveWriter> cipherArchive, residueArchive;
+  if (!INMEMORY) {
+    io.reset(new AsyncIO(numThreads));
+
+    cipherArchive.reset(new ArchiveWriter(DATAFOLDER + cipherArchiveLocation, io.get()));
+    if (!cipherArchive->good()) return false;
+
+    if (FLAGRNS) {
+      residueArchive.reset(new ArchiveWriter(AGGREGATORDATA + residueArchiveLocation, 
+                                             io.get()));
+      if (!residueArchive->good()) return false;
+    }
+  }
+
+  vector<vector<int64_t>> chunks(numThreads);
+  vector<vector<uint8_t>> buffers(INMEMORY ? numThreads : 0);
+  while (!failed) {
+    long unsigned int batch = 0;
+    while (batch < chunks.size() && reader.next(chunks[batch])) {
+      batch++;
+    }
+    if (batch == 0) break;
+
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+    for (long unsigned int j = 0; j < batch; j++) {
+      long unsigned int i = size + j;
+      vector<uint8_t> local;
+      vector<uint8_t> &buffer = INMEMORY ? buffers[j] : local;
+      auto begin = chrono::steady_clock::now();
+      if (!makeCipher(keyPair, cc, chunks[j], buffer) ||
+          (!INMEMORY && !cipherArchive->append(i, buffer.data(), buffer.size()))) {
+        #pragma omp atomic write
+        failed = true;
+        continue;
+      }
+      encryptHistogram.observe(elapsed(begin));
+
+      chunksMetric.add();
+      valuesMetric.add(chunks[j].size());
+      cipherBytesMetric.add(buffer.size());
+      cipherBytesHistogram.observe(buffer.size());
+
+      // ENCODING FOR SENDING // 
+      if (FLAGRNS) {
+        begin = chrono::steady_clock::now();
+        buffer = encoding(buffer.data(), buffer.size());
+        if (!INMEMORY && !residueArchive->append(i, buffer.data(), buffer.size())) {
+          #pragma omp atomic write
+          failed = true;
+          continue;
+        }
+        encodeHistogram.observe(elapsed(begin));
+
+        // DECODING FOR RECEVEING //
+        if (INMEMORY) {
+          begin = chrono::steady_clock::now();
+          buffer = decoding(buffer.data(), buffer.size(), i);
+          if (buffer.empty()) {
+            #pragma omp atomic write
+            failed = true;
+            continue;
+          }
+          decodeHistogram.observe(elapsed(begin));
+        }
+      }
     }
-    
-    if (SENDING) {
-      timing (false);
+
+    // AGGREGATION //
+    if (INMEMORY && !failed) {
+      vector<Ciphertext<DCRTPoly>> ciphers(batch);
+      for (long unsigned int j = 0; j < batch && !failed; j++) {
+        failed = !deserializeFromBuffer(buffers[j].data(), buffers[j].size(), ciphers[j],
+                                        SerType::BINARY);
+      }
+      if (failed) break;
+
+      auto begin = chrono::steady_clock::now();
+      addBatch(cc_ser, ciphers, size, sums);
+      adding += chrono::steady_clock::now() - begin;
     }
 
-    if (AGGREGATOR) {
-      timing (true);
+    if (VERIFY) {
+      addReference(reference, chunks, batch, size);
     }
+    size += batch;
+  }
+  if (failed || !reader.good()) return false;
+
+  if (INMEMORY) {
+    if (size == 0) return true;
+    // The additions done batch by batch count as aggregation
+    return decryptAggregate(cc_ser, sk, size, sums, reference, 
+                            chrono::steady_clock::now() - adding);
+  }
+
+  if (!closeArchive(*cipherArchive, DATAFOLDER + cipherArchiveLocation)) return false;
+  if (FLAGRNS && !closeArchive(*residueArchive, AGGREGATORDATA + residueArchiveLocation)) {
+    return false;
+  }
+
+  if (FLAGRNS) {   
     // DECODING FOR RECEVEING //
-    vector<vector<uint8_t>> dec = decoding(dataset);
-    for (long unsigned int i = 0; i < dec.size(); i++) {
-      writeAggregation(dec[i], AGGREGATORDATA+aggregatorFileName(i));
+    ArchiveReader residues(AGGREGATORDATA + residueArchiveLocation);
+    ArchiveWriter decoded(AGGREGATORDATA + aggregatorArchiveLocation, io.get());
+    if (!residues.good() || !decoded.good()) return false;
+
+    /* The residues are read ahead, and every cipher is decoded by the
+     * callback of its read while the following reads are in flight
+     */
+    for (long unsigned int i = 0; i < size; i++) {
+      residues.readAsync(*io, i, [&decoded, &failed, i](bool ok, vector<uint8_t> &packed) {
+        auto begin = chrono::steady_clock::now();
+        vector<uint8_t> dec;
+        if (ok) {
+          dec = decoding(packed.data(), packed.size(), i);
+        }
+        if (dec.empty() || !decoded.append(i, dec.data(), dec.size())) {
+          #pragma omp atomic write
+          failed = true;
+          return;
+        }
+        decodeHistogram.observe(elapsed(begin));
+      });
     }
+    io->drain();
+    if (failed) return false;
+
+    if (!closeArchive(decoded, AGGREGATORDATA + aggregatorArchiveLocation)) {
+      return false;
+    }
+  }
+
+  return serverProcess(cc, size, FLAGRNS, reference, *io);
+}
+
+/**
+ * @brief A chunk of the dataset, or the serialised cipher of a chunk or 
+ * its residues, on its way from a stage of the pipeline to the next one
+ */
+struct Packet {
+  long unsigned int id = 0;
+  vector<int64_t> values;
+  vector<uint8_t> bytes;
+};
 
-    serverProcess(cc, dec.size(), FLAGRNS);
+/**
+ * @brief It decrypts and prints the sum of the window just closed
+ * 
+ * @param cc_ser 
+ * @param sk 
+ * @param stream 
+ */
+void printWindow (CryptoContext<DCRTPoly> &cc_ser, const LPPrivateKey<DCRTPoly> &sk,
+                  const StreamAggregator &stream) {
+  Plaintext plainWindow;
+  if (FULLSLOTS) {
+    cc_ser->Decrypt(sk, cc_ser->EvalSum(stream.windowSum(), batchSize), &plainWindow);
+    plainWindow->SetLength(1);
   }
   else {
-    serverProcess(cc, v.size(), FLAGRNS);
-  }  
+    cc_ser->Decrypt(sk, stream.windowSum(), &plainWindow);
+  }
+
+  metrics.add("windows");
+  cout << "\n > Window of arrivals " << stream.arrivals() - windowSize << "-" 
+       << stream.arrivals() - 1 << "\n" 
+       << "Sum: " << plainWindow << endl;
 }
 
 /**
- * @brief It reads distances from the text file
+ * @brief Staged version of palisade(): reading, encryption, RRNS encoding,
+ * decoding and aggregation run at the same time, connected by bounded 
+ * queues, so that a chunk is encrypted while the previous ones are encoded,
+ * decoded and added. A stage blocked on a full queue holds back the one 
+ * before it, thus at most queueDepth chunks or ciphers wait between two 
+ * stages, whatever the size of the dataset, and the run goes at the pace of
+ * the slowest stage.
+ * Encryption, encoding and decoding run on numThreads workers each; the
+ * aggregator is a single thread, as deserializing a cipher is not thread
+ * safe, and it adds every cipher to the running total, the window and the
+ * sum of its group in place as soon as it arrives, printing every window
+ * that closes. The ciphers are handed between the stages in memory.
  * 
- * @return vector<vector<int64_t>> 
+ * @param cc 
+ * @param keyPair 
+ * @param reader The dataset, read a chunk at a time
+ * @param FLAGRNS It indicates whether or not apply the RRNS encoding
+ * @return true 
+ * @return false If a stage failed
  */
-vector<vector<int64_t>> readDataset() {
-  if (SENDING) {
-    timing (true);
+bool pipeline (CryptoContext<DCRTPoly> &cc, const LPKeyPair<DCRTPoly> &keyPair,
+               DatasetReader &reader, bool FLAGRNS) {
+
+  // The aggregator has its keys before the first cipher arrives
+  CryptoContext<DCRTPoly> cc_ser;
+  LPPrivateKey<DCRTPoly> sk;
+  if (!openAggregator(cc, cc_ser, sk)) return false;
+
+  atomic<bool> failed(false);
+  size_t capacity = queueDepth > 0 ? queueDepth : 2 * numThreads;
+  auto start = chrono::steady_clock::now();
+
+  BoundedQueue<Packet> chunks(capacity);
+  BoundedQueue<Packet> ciphers(capacity, numThreads);
+  BoundedQueue<Packet> residues(capacity, numThreads);
+  BoundedQueue<Packet> decoded(capacity, numThreads);
+
+  // Without the RRNS encoding the ciphers go straight to the aggregator
+  BoundedQueue<Packet> &arrivals = FLAGRNS ? decoded : ciphers;
+
+  /* Every worker of a stage takes packets from in and pushes them on out;
+   * after a failure it still drains in, so that no stage waits for ever
+   */
+  vector<thread> workers;
+  auto stage = [&](BoundedQueue<Packet> &in, BoundedQueue<Packet> &out,
+                   function<bool (Packet &)> work) {
+    for (int t = 0; t < numThreads; t++) {
+      workers.emplace_back([&in, &out, &failed, work]() {
+        Packet packet;
+        while (in.pop(packet)) {
+          if (failed || !work(packet)) {
+            failed = true;
+            continue;
+          }
+          out.push(move(packet));
+        }
+        out.close();
+      });
+    }
+  };
+
+  stage(chunks, ciphers, [&](Packet &packet) {
+    auto begin = chrono::steady_clock::now();
+    if (!makeCipher(keyPair, cc, packet.values, packet.bytes)) return false;
+    encryptHistogram.observe(elapsed(begin));
+
+    chunksMetric.add();
+    valuesMetric.add(packet.values.size());
+    cipherBytesMetric.add(packet.bytes.size());
+    cipherBytesHistogram.observe(packet.bytes.size());
+    vector<int64_t>().swap(packet.values);
+    return true;
+  });
+
+  if (FLAGRNS) {
+    // ENCODING FOR SENDING //
+    stage(ciphers, residues, [](Packet &packet) {
+      auto begin = chrono::steady_clock::now();
+      packet.bytes = encoding(packet.bytes.data(), packet.bytes.size());
+      encodeHistogram.observe(elapsed(begin));
+      return true;
+    });
+
+    // DECODING FOR RECEVEING //
+    stage(residues, decoded, [](Packet &packet) {
+      auto begin = chrono::steady_clock::now();
+      vector<uint8_t> dec = decoding(packet.bytes.data(), packet.bytes.size(), packet.id);
+      if (dec.empty()) return false;
+
+      packet.bytes.swap(dec);
+      decodeHistogram.observe(elapsed(begin));
+      return true;
+    });
   }
 
-  ifstream file;
-  file.open(DISTANCEINT);
+  // AGGREGATION //
+  StreamAggregator stream(cc_ser, windowSize, windowSlide);
+  vector<Ciphertext<DCRTPoly>> sums;
+  thread aggregator([&]() {
+    Packet packet;
+    while (arrivals.pop(packet)) {
+      if (failed) continue;
+
+      auto begin = chrono::steady_clock::now();
+      Ciphertext<DCRTPoly> cipher;
+      if (!deserializeFromBuffer(packet.bytes.data(), packet.bytes.size(), cipher, 
+                                 SerType::BINARY)) {
+        failed = true;
+        continue;
+      }
 
-  file.seekg(0, ios::end);
-  file.seekg(0, ios::beg);
+      stream.add(cipher);
+
+      // The group sum starts from the first cipher of the group itself
+      if (groupSize > 0) {
+        long unsigned int g = packet.id / groupSize;
+        if (sums.size() <= g) {
+          sums.resize(g + 1);
+        }
+        if (sums[g]) {
+          cc_ser->EvalAddInPlace(sums[g], cipher);
+        }
+        else {
+          sums[g] = cipher;
+        }
+      }
+      aggregateAddHistogram.observe(elapsed(begin));
 
-  int value;
-  vector<int64_t> values;
+      if (stream.windowClosed()) {
+        printWindow(cc_ser, sk, stream);
+      }
+    }
+  });
+
+  // The dataset is read here, as fast as the encryption takes the chunks
+  vector<vector<int64_t>> reference;
+  vector<vector<int64_t>> chunk(1);
+  long unsigned int read = 0;
+  while (!failed && reader.next(chunk[0])) {
+    if (VERIFY) {
+      addReference(reference, chunk, 1, read);
+    }
+
+    Packet packet;
+    packet.id = read++;
+    packet.values.swap(chunk[0]);
+    chunks.push(move(packet));
+  }
+  chunks.close();
+
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  aggregator.join();
+  if (failed || !reader.good()) return false;
 
-  // Reading 765041 distances
-  if (file) {
-    while ( file >> value ) {
-      values.push_back(value);
+  metrics.set("pipeline_seconds", 
+              chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  metrics.set("queue_depth", chunks.capacity());
+
+  if (stream.arrivals() == 0) return true;
+  if (groupSize == 0) {
+    sums.assign(1, stream.total());
+  }
+  return decryptAggregate(cc_ser, sk, stream.arrivals(), sums, reference, 
+                          chrono::steady_clock::now());
+}
+
+/**
+ * @brief Summary sent by a shard of the aggregator with its end record,
+ * followed by the snapshot of the metrics of the shard
+ */
+struct ShardReport {
+  uint64_t ciphers = 0;
+  double seconds = 0;     // spent decoding, deserializing and adding
+};
+
+/**
+ * @brief A shard of the aggregator, in a process of its own: it receives 
+ * the ciphers of its chunks from the socket, RRNS encoded if FLAGRNS, 
+ * decodes them and adds each to the sum of its group in place. At the end
+ * record it sends back the sums, each in a record of its group, then its 
+ * report with its metrics, which the root merges into its own. It never
+ * holds the secret key; the cryptocontext and the 
+ * evaluation keys are loaded at the first record, as the root stores them
+ * after starting the shards.
+ * 
+ * @param fd The socket of the shard
+ * @param FLAGRNS 
+ * @return int Exit status of the process
+ */
+int shardProcess (int fd, bool FLAGRNS) {
+  uint64_t id;
+  vector<uint8_t> bytes;
+  if (!receiveRecord(fd, id, bytes)) return 1;
+
+  CryptoContext<DCRTPoly> cc_ser;
+  if (!loadAggregator(cc_ser)) return 1;
+
+  // The registry copied by fork holds the metrics of the root so far
+  metrics.clear();
+
+  ShardReport report;
+  vector<Ciphertext<DCRTPoly>> sums;
+  while (id != ENDRECORD) {
+    auto begin = chrono::steady_clock::now();
+    if (FLAGRNS) {
+      bytes = decoding(bytes.data(), bytes.size(), id);
+      if (bytes.empty()) return 1;
+      decodeHistogram.observe(elapsed(begin));
+    }
+
+    auto adding = chrono::steady_clock::now();
+    Ciphertext<DCRTPoly> cipher;
+    if (!deserializeFromBuffer(bytes.data(), bytes.size(), cipher, SerType::BINARY)) {
+      return 1;
+    }
+
+    uint64_t g = groupSize > 0 ? id / groupSize : 0;
+    if (sums.size() <= g) {
+      sums.resize(g + 1);
+    }
+    if (sums[g]) {
+      cc_ser->EvalAddInPlace(sums[g], cipher);
+    }
+    else {
+      sums[g] = cipher;
+    }
+    aggregateAddHistogram.observe(elapsed(adding));
+
+    report.ciphers++;
+    report.seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    if (!receiveRecord(fd, id, bytes)) return 1;
+  }
+
+  for (uint64_t g = 0; g < sums.size(); g++) {
+    if (!sums[g]) continue;
+
+    if (!serializeToBuffer(bytes, sums[g], SerType::BINARY) ||
+        !sendRecord(fd, g, bytes.data(), bytes.size())) {
+      return 1;
+    }
+  }
+  bytes.assign((const uint8_t *) &report, (const uint8_t *) &report + sizeof(report));
+  vector<uint8_t> snapshot = metrics.snapshot();
+  bytes.insert(bytes.end(), snapshot.begin(), snapshot.end());
+  return sendRecord(fd, ENDRECORD, bytes.data(), bytes.size()) ? 0 : 1;
+}
+
+/**
+ * @brief It forks the shards of the aggregator, each connected to the root
+ * by a pair of Unix domain sockets. It runs before any other thread is 
+ * started, as a forked process keeps only the thread that forked.
+ * 
+ * @param FLAGRNS 
+ * @param sockets The root end of the socket of every shard
+ * @param pids 
+ * @return true 
+ * @return false If a shard cannot be started
+ */
+bool startShards (bool FLAGRNS, vector<int> &sockets, vector<pid_t> &pids) {
+  // Nothing buffered must be printed again by the shards
+  cout.flush();
+
+  for (int k = 0; k < shards; k++) {
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+      cerr << "Could not create the socket of shard " << k << ": " << strerror(errno) << endl;
+      return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      cerr << "Could not start shard " << k << ": " << strerror(errno) << endl;
+      close(ends[0]);
+      close(ends[1]);
+      return false;
+    }
+
+    if (pid == 0) {
+      for (int fd : sockets) {
+        close(fd);
+      }
+      close(ends[0]);
+      _exit(shardProcess(ends[1], FLAGRNS));
+    }
+
+    close(ends[1]);
+    sockets.push_back(ends[0]);
+    pids.push_back(pid);
+  }
+  return true;
+}
+
+/**
+ * @brief It closes the sockets of the shards, which then exit, and waits
+ * for them
+ * 
+ * @param sockets 
+ * @param pids 
+ * @return true 
+ * @return false If a shard failed
+ */
+bool stopShards (const vector<int> &sockets, const vector<pid_t> &pids) {
+  for (int fd : sockets) {
+    close(fd);
+  }
+
+  bool ok = true;
+  for (size_t k = 0; k < pids.size(); k++) {
+    int status;
+    if (waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      cerr << "Shard " << k << " of the aggregator failed" << endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/**
+ * @brief Sharded version of the aggregator: the chunks are encrypted and
+ * RRNS encoded a batch at a time, and the cipher of chunk i is sent to 
+ * shard i mod shards as soon as its batch is encoded; at the end every 
+ * shard sends back its partial sums and the root adds them into the 
+ * aggregates. The time from the first cipher sent to the last partial 
+ * received gives the throughput of the aggregation.
+ * 
+ * @param cc 
+ * @param keyPair 
+ * @param reader The dataset, read a chunk at a time
+ * @param FLAGRNS It indicates whether or not apply the RRNS encoding
+ * @param sockets The root end of the socket of every shard
+ * @return true 
+ * @return false If a stage or a shard failed
+ */
+bool shardedAggregation (CryptoContext<DCRTPoly> &cc, const LPKeyPair<DCRTPoly> &keyPair,
+                         DatasetReader &reader, bool FLAGRNS, const vector<int> &sockets) {
+
+  bool failed = false;
+  vector<vector<int64_t>> reference;
+  long unsigned int size = 0;
+  size_t n = sockets.size();
+
+  /* --- SENDING ---
+   * The dataset is streamed: numThreads chunks at a time are read, then 
+   * encrypted and encoded in parallel, and every cipher is sent to its 
+   * shard before the next chunks are read into the same buffers. A shard
+   * reads a whole record before decoding it, so it works on its cipher 
+   * while the root sends to the others.
+   */
+  vector<vector<int64_t>> chunks(numThreads);
+  vector<vector<uint8_t>> buffers(numThreads);
+  chrono::steady_clock::time_point start;
+  while (!failed) {
+    long unsigned int batch = 0;
+    while (batch < chunks.size() && reader.next(chunks[batch])) {
+      batch++;
+    }
+    if (batch == 0) break;
+
+    #pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+    for (long unsigned int j = 0; j < batch; j++) {
+      vector<uint8_t> &buffer = buffers[j];
+      auto begin = chrono::steady_clock::now();
+      if (!makeCipher(keyPair, cc, chunks[j], buffer)) {
+        #pragma omp atomic write
+        failed = true;
+        continue;
+      }
+      encryptHistogram.observe(elapsed(begin));
+
+      chunksMetric.add();
+      valuesMetric.add(chunks[j].size());
+      cipherBytesMetric.add(buffer.size());
+      cipherBytesHistogram.observe(buffer.size());
+
+      if (FLAGRNS) {
+        begin = chrono::steady_clock::now();
+        buffer = encoding(buffer.data(), buffer.size());
+        encodeHistogram.observe(elapsed(begin));
+      }
+    }
+    if (failed) break;
+
+    if (size == 0) {
+      start = chrono::steady_clock::now();
+    }
+    for (long unsigned int j = 0; j < batch; j++) {
+      long unsigned int i = size + j;
+      if (!sendRecord(sockets[i % n], i, buffers[j].data(), buffers[j].size())) {
+        return false;
+      }
+    }
+
+    if (VERIFY) {
+      addReference(reference, chunks, batch, size);
+    }
+    size += batch;
+  }
+  if (failed || !reader.good()) return false;
+
+  if (size == 0) {
+    start = chrono::steady_clock::now();
+  }
+  for (size_t k = 0; k < n; k++) {
+    if (!sendRecord(sockets[k], ENDRECORD, nullptr, 0)) return false;
+  }
+
+  // AGGREGATION //
+  /* A thread of the root collects the partial sums of every shard, which
+   * replies only after the end record
+   */
+  vector<vector<pair<uint64_t, vector<uint8_t>>>> replies(n);
+  vector<ShardReport> reports(n);
+  vector<vector<uint8_t>> snapshots(n);
+  atomic<bool> lost(false);
+  vector<thread> receivers;
+
+  for (size_t k = 0; k < n; k++) {
+    receivers.emplace_back([&, k]() {
+      uint64_t id;
+      vector<uint8_t> bytes;
+      while (receiveRecord(sockets[k], id, bytes)) {
+        if (id == ENDRECORD) {
+          if (bytes.size() < sizeof(ShardReport)) break;
+
+          memcpy(&reports[k], bytes.data(), sizeof(ShardReport));
+          snapshots[k].assign(bytes.begin() + sizeof(ShardReport), bytes.end());
+          return;
+        }
+        replies[k].emplace_back(id, move(bytes));
+      }
+      lost = true;
+    });
+  }
+
+  for (thread &receiver : receivers) {
+    receiver.join();
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (lost) return false;
+
+  // The root combiner
+  CryptoContext<DCRTPoly> cc_ser;
+  LPPrivateKey<DCRTPoly> sk;
+  if (!openAggregator(cc, cc_ser, sk)) return false;
+
+  vector<Ciphertext<DCRTPoly>> sums;
+  uint64_t aggregated = 0;
+  for (size_t k = 0; k < n; k++) {
+    for (const pair<uint64_t, vector<uint8_t>> &reply : replies[k]) {
+      Ciphertext<DCRTPoly> partial;
+      if (!deserializeFromBuffer(reply.second.data(), reply.second.size(), partial, 
+                                 SerType::BINARY)) {
+        return false;
+      }
+
+      uint64_t g = reply.first;
+      if (sums.size() <= g) {
+        sums.resize(g + 1);
+      }
+      if (sums[g]) {
+        cc_ser->EvalAddInPlace(sums[g], partial);
+      }
+      else {
+        sums[g] = partial;
+      }
+    }
+
+    aggregated += reports[k].ciphers;
+    metrics.observe("shard_seconds", reports[k].seconds);
+    if (!metrics.merge(snapshots[k].data(), snapshots[k].size())) {
+      cerr << "The metrics of shard " << k << " are truncated" << endl;
+      return false;
+    }
+  }
+
+  if (aggregated != size) {
+    cerr << "The shards aggregated " << aggregated << " of " << size << " ciphers" << endl;
+    return false;
+  }
+
+  metrics.set("shards", n);
+  metrics.set("sharded_aggregation_seconds", seconds);
+  metrics.set("sharded_ciphers_per_second", seconds > 0 ? size / seconds : 0);
+
+  cout << "\n > Sharded aggregation\n"
+       << "Shards: " << n << ", ciphers: " << size << ", seconds: " << seconds 
+       << ", ciphers/s: " << (seconds > 0 ? size / seconds : 0) << endl;
+
+  if (size == 0) return true;
+  return decryptAggregate(cc_ser, sk, size, sums, reference, chrono::steady_clock::now());
+}
+
+/**
+ * @brief The cryptocontext and key pair of the current parameters: loaded
+ * from the store when it holds them, otherwise generated and stored
+ * 
+ * @param cc 
+ * @param keyPair 
+ * @return true 
+ * @return false 
+ */
+bool loadContext (CryptoContext<DCRTPoly> &cc, LPKeyPair<DCRTPoly> &keyPair) {
+  string parameters = contextParameters();
+
+  if (openStore(parameters, cc, keyPair)) {
+    return serializeRequiredKeys(keyPair.secretKey, cc);
+  }
+
+  cc = setup(); 
+  if (!cc) return false;
+
+  keyPair = cc->KeyGen();
+  return serializeKeys(keyPair, cc) && closeStore(parameters);
+}
+
+/**
+ * @brief It derives the ratios of the run from the counters, adds the 
+ * sizes of the stored keys and writes all the metrics as JSON on metricsFile
+ * 
+ * @return true 
+ * @return false If the file cannot be written
+ */
+bool dumpMetrics () {
+  double values = metrics.counter("values");
+  double input = metrics.counter("rrns_input_bytes");
+
+  if (input > 0) {
+    metrics.set("rrns_expansion", metrics.counter("rrns_packed_bytes") / input);
+  }
+  if (values > 0) {
+    metrics.set("cipher_bytes_per_distance", metrics.counter("cipher_bytes") / values);
+    metrics.set("rrns_bytes_per_distance", metrics.counter("rrns_packed_bytes") / values);
+  }
+
+  for (const string &location : {cryptoLocation, keyPubLocation, keyPriLocation,
+                                 keyMultLocation, keyRotLocation, keySumLocation}) {
+    long bytes = fileSize(DATAFOLDER + location);
+    if (bytes >= 0) {
+      metrics.set("file_bytes." + location.substr(1), bytes);
     }
   }
-  file.close();
 
-  // Splitting values into mulitple arrays
-  int chunk_size = 5000;
-  vector<vector<int64_t>> splits;
+  ofstream fout(metricsFile);
+  fout << metrics.json();
+  if (!fout) {
+    cerr << "Could not write the metrics on " << metricsFile << endl;
+    return false;
+  }
+  return true;
+}
+
+#ifdef BENCHMARK
+// Measured repetitions of the benchmark, after the discarded warmup ones
+int repetitions = 10;
+int warmup = 1;
 
-  for(size_t i = 0; i < values.size(); i += chunk_size) {
-    auto last = min(values.size(), i + chunk_size);
-    splits.emplace_back(values.begin() + i, values.begin() + last);
+/**
+ * @brief Wall time of a stage run over all the chunks in parallel
+ * 
+ * @tparam F 
+ * @param stage It processes the i-th chunk, returning false on error
+ * @param n Number of chunks
+ * @return double Seconds, negative if the stage failed
+ */
+template <typename F>
+double timeStage (F stage, long unsigned int n) {
+  bool failed = false;
+  auto begin = chrono::steady_clock::now();
+
+  #pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+  for (long unsigned int i = 0; i < n; i++) {
+    if (!stage(i)) {
+      #pragma omp atomic write
+      failed = true;
+    }
   }
 
-  return splits;
+  double seconds = elapsed(begin);
+  return failed ? -1 : seconds;
 }
 
-int main() {
+/**
+ * @brief Stage-level benchmark of the pipeline: every stage runs on its own
+ * over the whole dataset, and its wall time is measured at each repetition.
+ * Throughput is given over the dataset bytes for the reading, and over the 
+ * serialised cipher bytes for the other stages. The decryption covers, as in
+ * the aggregator, the total and the partial sums of the groups if groupSize 
+ * is set, not every cipher. The report is a JSON object.
+ * 
+ * @param cc 
+ * @param keyPair 
+ * @param FLAGRNS Whether the RRNS stages are measured
+ * @return int Exit status
+ */
+int benchmark (CryptoContext<DCRTPoly> &cc, const LPKeyPair<DCRTPoly> &keyPair,
+               bool FLAGRNS) {
+  const vector<string> stages = {"read", "encrypt", "compress", "serialize", 
+                                 "rrns-encode", "rrns-decode", "deserialize", 
+                                 "add", "decrypt"};
+  vector<vector<double>> samples(stages.size());
+  long unsigned int chunks = 0, values = 0, datasetBytes = 0, cipherBytes = 0;
+
+  // The store keeps the summation keys for the aggregator only
+  if (FULLSLOTS) {
+    cc->EvalSumKeyGen(keyPair.secretKey);
+  }
+
+  for (int r = 0; r < warmup + repetitions; r++) {
+    vector<double> t(stages.size(), 0);
+
+    // read
+    auto begin = chrono::steady_clock::now();
+    DatasetReader reader(DISTANCEINT, chunkSize);
+    vector<vector<int64_t>> v;
+    vector<int64_t> chunk;
+    while (reader.next(chunk)) {
+      v.push_back(chunk);
+    }
+    if (!reader.good()) return 1;
+    t[0] = elapsed(begin);
+
+    long unsigned int n = v.size();
+    vector<Ciphertext<DCRTPoly>> ciphers(n);
+    vector<vector<uint8_t>> buffers(n), packed(n);
+
+    t[1] = timeStage([&](long unsigned int i) {
+      ciphers[i] = encryptChunk(keyPair, cc, v[i]);
+      return true;
+    }, n);
+
+    t[2] = timeStage([&](long unsigned int i) {
+      ciphers[i] = compressCipher(cc, ciphers[i]);
+      return true;
+    }, n);
+
+    t[3] = timeStage([&](long unsigned int i) {
+      return serializeToBuffer(buffers[i], ciphers[i], SerType::BINARY);
+    }, n);
+
+    cipherBytes = 0;
+    for (auto &b : buffers) cipherBytes += b.size();
+
+    if (FLAGRNS) {
+      t[4] = timeStage([&](long unsigned int i) {
+        packed[i] = encoding(buffers[i].data(), buffers[i].size());
+        return true;
+      }, n);
+
+      t[5] = timeStage([&](long unsigned int i) {
+        buffers[i] = decoding(packed[i].data(), packed[i].size(), i);
+        return !buffers[i].empty();
+      }, n);
+    }
+
+    // Sequential, as in the aggregator
+    begin = chrono::steady_clock::now();
+    for (long unsigned int i = 0; i < n; i++) {
+      if (!deserializeFromBuffer(buffers[i].data(), buffers[i].size(), ciphers[i], 
+                                 SerType::BINARY)) return 1;
+    }
+    t[6] = elapsed(begin);
+
+    // As in the aggregator: the partial sums of the groups, then the total
+    begin = chrono::steady_clock::now();
+    vector<Ciphertext<DCRTPoly>> partials;
+    addBatch(cc, ciphers, 0, partials);
+    Ciphertext<DCRTPoly> sum;
+    if (n > 0) {
+      vector<Ciphertext<DCRTPoly>> total(partials);
+      sum = evalAddTree(cc, total);
+      if (FULLSLOTS) sum = cc->EvalSum(sum, batchSize);
+    }
+    if (groupSize == 0) {
+      partials.clear();
+    }
+    t[7] = elapsed(begin);
+
+    // Only the aggregates are decrypted: the partials, if any, and the total
+    t[8] = timeStage([&](long unsigned int i) {
+      Plaintext plain;
+      if (i == partials.size()) {
+        cc->Decrypt(keyPair.secretKey, sum, &plain);
+      }
+      else if (FULLSLOTS) {
+        cc->Decrypt(keyPair.secretKey, cc->EvalSum(partials[i], batchSize), &plain);
+      }
+      else {
+        cc->Decrypt(keyPair.secretKey, partials[i], &plain);
+      }
+      return true;
+    }, n > 0 ? partials.size() + 1 : 0);
+
+    for (double x : t) {
+      if (x < 0) return 1;
+    }
+
+    if (r >= warmup) {
+      for (size_t s = 0; s < stages.size(); s++) {
+        samples[s].push_back(t[s]);
+      }
+    }
+
+    chunks = n;
+    values = 0;
+    for (auto &c : v) values += c.size();
+  }
+
+  MappedFile dataset(DISTANCEINT);
+  datasetBytes = dataset.size();
+
+  printf("{\"parameters\": \"%s\", \"threads\": %d, \"rrns\": %s, "
+         "\"repetitions\": %d, \"warmup\": %d, \"chunks\": %lu, \"values\": %lu, "
+         "\"dataset_bytes\": %lu, \"cipher_bytes\": %lu, \"stages\": [", 
+         contextParameters().c_str(), numThreads, FLAGRNS ? "true" : "false",
+         repetitions, warmup, chunks, values, datasetBytes, cipherBytes);
+
+  bool first = true;
+  for (size_t s = 0; s < stages.size(); s++) {
+    if (!FLAGRNS && stages[s].compare(0, 5, "rrns-") == 0) continue;
+
+    BenchStats stats = benchSummary(samples[s]);
+    double bytes = s == 0 ? datasetBytes : cipherBytes;
+    double median = stats.median > 0 ? stats.median : 1e-9;
+
+    printf("%s\n  {\"stage\": \"%s\", \"min\": %.6f, \"median\": %.6f, \"p99\": %.6f, "
+           "\"MB_per_s\": %.3f, \"values_per_s\": %.1f}", 
+           first ? "" : ",", stages[s].c_str(), stats.min, stats.median, stats.p99,
+           bytes / median / 1e6, values / median);
+    first = false;
+  }
+  printf("\n]}\n");
+  return 0;
+}
+#endif
+
+#ifdef SWEEP
+/* Grid of the sweep: every RNS base (range of its primes), chunk size 
+ * and number of towers left by the compression is run for every context 
+ * of the depth and plaintext modulus
+ */
+vector<pair<int, int>> bases = {{0, 30}, {0, 40}, {0, 45}};
+vector<int> chunks = {1000, 2500, 5000};
+vector<int> towers = {1, 2};
+vector<int> depths = {(int) depth};
+vector<int> moduli = {PLAINTEXTMODULUS};
+
+/**
+ * @brief Comma separated list of integers
+ * 
+ * @param arg 
+ * @return vector<int> 
+ */
+vector<int> parseList (const string &arg) {
+  vector<int> list;
+  stringstream ss(arg);
+  string item;
+
+  while (getline(ss, item, ',')) {
+    list.push_back(atoi(item.c_str()));
+  }
+  return list;
+}
+
+/**
+ * @brief Comma separated list of LOW-HIGH ranges
+ * 
+ * @param arg 
+ * @return vector<pair<int, int>> 
+ */
+vector<pair<int, int>> parseRanges (const string &arg) {
+  vector<pair<int, int>> ranges;
+  stringstream ss(arg);
+  string item;
+
+  while (getline(ss, item, ',')) {
+    size_t dash = item.find('-');
+    if (dash == string::npos) continue;
+    ranges.push_back({atoi(item.substr(0, dash).c_str()), 
+                      atoi(item.substr(dash + 1).c_str())});
+  }
+  return ranges;
+}
+
+/**
+ * @brief It runs the whole pipeline for every point of the grid and prints
+ * a row of throughput, sizes and latencies for each of them. The points 
+ * are ordered so that a cryptocontext and its keys, loaded from the store
+ * or generated once, serve all the bases, chunk sizes and compressions of
+ * its depths and plaintext moduli. The output of the aggregator is discarded.
+ * 
+ * @param FLAGRNS 
+ * @return int Exit code
+ */
+int sweep (bool FLAGRNS) {
+  // Without the RRNS stages the base makes no difference
+  if (!FLAGRNS) {
+    bases.resize(1);
+  }
+
+  // The slot encoding fixes the plaintext modulus and the chunk size
+  if (FULLSLOTS) {
+    moduli.assign(1, BATCHMODULUS);
+    chunks.assign(1, 0);
+  }
+
+  printf("%s  moduli  chunk  towers  ciphers  cipher_B  rrns_x  B/distance"
+         "  encrypt_ms  encode_ms  decode_ms  aggregate_ms  seconds  distances/s\n",
+         "depth    modulus");
+
+  bool failed = false;
+  for (int d : depths) {
+    for (int p : moduli) {
+      depth = d;
+      PLAINTEXTMODULUS = p;
+
+      CryptoContext<DCRTPoly> cc;
+      LPKeyPair<DCRTPoly> keyPair;
+      if (!loadContext(cc, keyPair)) {
+        failed = true;
+        continue;
+      }
+
+      for (auto &range : bases) {
+        if (!setBase(range.first, range.second)) {
+          failed = true;
+          continue;
+        }
+
+        for (int c : chunks) {
+          if (c > 0) chunkSize = c;
+
+          for (int t : towers) {
+            // A fresh cipher has depth + 1 towers
+            if (t < 1 || t > (int) depth + 1) continue;
+            towersLeft = t;
+
+            DatasetReader reader(DISTANCEINT, chunkSize);
+            if (!reader.good()) return 1;
+
+            metrics.clear();
+            streambuf *out = cout.rdbuf(nullptr);
+            auto begin = chrono::steady_clock::now();
+            bool done = palisade(cc, keyPair, reader, FLAGRNS);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            cout.rdbuf(out);
+
+            if (!done) {
+              cerr << "The pipeline failed with chunk " << chunkSize 
+                   << " and " << t << " towers" << endl;
+              failed = true;
+              continue;
+            }
+
+            double values = metrics.counter("values");
+            double cipherBytes = metrics.counter("cipher_bytes");
+            double wireBytes = FLAGRNS ? metrics.counter("rrns_packed_bytes") : cipherBytes;
+
+            printf("%5d  %9d  %6zu  %5zu  %6d  %7llu  %8.0f  %6.3f  %10.2f"
+                   "  %10.3f  %9.3f  %9.3f  %12.3f  %7.3f  %11.0f\n",
+                   depth, FULLSLOTS ? BATCHMODULUS : PLAINTEXTMODULUS, FLAGRNS ? base.size() : (size_t) 0, chunkSize, t,
+                   (unsigned long long) metrics.counter("chunks"),
+                   metrics.mean("cipher_bytes"), 
+                   cipherBytes > 0 ? wireBytes / cipherBytes : 0,
+                   values > 0 ? wireBytes / values : 0,
+                   1e3 * metrics.mean("encrypt_seconds"),
+                   1e3 * metrics.mean("rrns_encode_seconds"),
+                   1e3 * metrics.mean("rrns_decode_seconds"),
+                   1e3 * metrics.gauge("aggregate_seconds"),
+                   seconds, seconds > 0 ? values / seconds : 0);
+            fflush(stdout);
+          }
+        }
+      }
+    }
+  }
+  return failed ? 1 : 0;
+}
+#endif
+
+int main(int argc, char *argv[]) {
   ios_base::sync_with_stdio(0);
 
   // Flag that decides whether to activate RNS or not
   bool FLAGRNS = true;
+  int width = 1;
+#ifdef SWEEP
+  bool basesGiven = false;
+#endif
+
+  for (int a = 1; a < argc; a++) {
+    string arg = argv[a];
+
+    if (arg == "--threads" && a + 1 < argc) {
+      numThreads = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--groups" && a + 1 < argc) {
+      groupSize = max(0, atoi(argv[++a]));
+    }
+    else if (arg == "--in-memory") {
+      INMEMORY = true;
+    }
+    else if (arg == "--pipeline") {
+      PIPELINE = true;
+    }
+    else if (arg == "--queue-depth" && a + 1 < argc) {
+      queueDepth = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--window" && a + 1 < argc) {
+      windowSize = max(1, atoi(argv[++a]));
+      PIPELINE = true;
+    }
+    else if (arg == "--slide" && a + 1 < argc) {
+      windowSlide = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--shards" && a + 1 < argc) {
+      shards = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--full-slots") {
+      FULLSLOTS = true;
+    }
+    else if (arg == "--symbol-width" && a + 1 < argc) {
+      width = atoi(argv[++a]);
+    }
+    else if (arg == "--no-rrns") {
+      FLAGRNS = false;
+    }
+    else if (arg == "--verify") {
+      VERIFY = true;
+    }
+    else if (arg == "--metrics" && a + 1 < argc) {
+      metricsFile = argv[++a];
+    }
+#ifdef BENCHMARK
+    else if (arg == "--reps" && a + 1 < argc) {
+      repetitions = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--warmup" && a + 1 < argc) {
+      warmup = max(0, atoi(argv[++a]));
+    }
+#endif
+#ifdef SWEEP
+    else if (arg == "--bases" && a + 1 < argc) {
+      bases = parseRanges(argv[++a]);
+      basesGiven = true;
+    }
+    else if (arg == "--chunks" && a + 1 < argc) {
+      chunks = parseList(argv[++a]);
+    }
+    else if (arg == "--towers" && a + 1 < argc) {
+      towers = parseList(argv[++a]);
+    }
+    else if (arg == "--depths" && a + 1 < argc) {
+      depths = parseList(argv[++a]);
+    }
+    else if (arg == "--moduli" && a + 1 < argc) {
+      moduli = parseList(argv[++a]);
+    }
+#endif
+    else {
+      cerr << "Usage: " << argv[0] 
+           << " [--threads N] [--groups N] [--in-memory] [--pipeline] [--queue-depth N]"
+           << " [--window N] [--slide N] [--shards N] [--full-slots]"
+           << " [--symbol-width 1|2|3|4] [--no-rrns]"
+           << " [--verify] [--metrics PATH]"
+#ifdef BENCHMARK
+           << " [--reps N] [--warmup N]"
+#endif
+#ifdef SWEEP
+           << " [--bases LOW-HIGH,...] [--chunks N,...] [--towers N,...]"
+           << " [--depths N,...] [--moduli P,...]"
+#endif
+           << endl;
+      return 1;
+    }
+  }
 
-  CryptoContext<DCRTPoly> cc = setup(); 
-  vector<vector<int64_t>> values = readDataset();
+  if (windowSize > 0 && windowSlide > 0 && windowSize % windowSlide != 0) {
+    cerr << "The window must be a multiple of the slide" << endl;
+    return 1;
+  }
+
+  if (shards > 0 && PIPELINE) {
+    cerr << "The sharded aggregator does not run in the pipeline" << endl;
+    return 1;
+  }
+
+  if (!setSymbolWidth(width)) return 1;
+
+#ifdef SWEEP
+  // The default ranges are meant for 1-byte symbols
+  if (!basesGiven && SYMBOLWIDTH != 1) {
+    bases.assign(1, {0, base.back() + 1});
+  }
+  return sweep(FLAGRNS);
+#endif
+
+  vector<int> sockets;
+  vector<pid_t> pids;
+  if (shards > 0 && !startShards(FLAGRNS, sockets, pids)) return 1;
+
+  // The context and keys are generated only if the store misses
+  CryptoContext<DCRTPoly> cc;
+  LPKeyPair<DCRTPoly> keyPair;
+  if (!loadContext(cc, keyPair)) return 1;
+
+#ifdef BENCHMARK
+  return benchmark(cc, keyPair, FLAGRNS);
+#endif
+
+  DatasetReader reader(DISTANCEINT, chunkSize);
+  if (!reader.good()) return 1;
+
+  bool done;
+  if (shards > 0) {
+    done = shardedAggregation(cc, keyPair, reader, FLAGRNS, sockets);
+    done = stopShards(sockets, pids) && done;
+  }
+  else {
+    done = PIPELINE ? pipeline(cc, keyPair, reader, FLAGRNS)
+                    : palisade(cc, keyPair, reader, FLAGRNS);
+  }
+  if (!done) return 1;
 
-  palisade (cc, values, FLAGRNS);
+  if (!metricsFile.empty() && !dumpMetrics()) return 1;
 
   return 0;
 }
\ No newline at end of file
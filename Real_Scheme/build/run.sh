@@ -1,2 +0,0 @@
-#!/bin/sh
-for i in {1..100} ; do ./run >> t.txt ; done
\ No newline at end of file
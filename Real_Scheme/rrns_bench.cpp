@@ -0,0 +1,358 @@
+/**
+ * @file rrns_bench.cpp
+ * @brief Micro-benchmark of the RNS and RRNS kernels of helpers.cpp,
+ * run on their own over a byte stream, for the bases used by main.cpp.
+ * Every result is a JSON line, with the best time over the repetitions.
+ *
+ * Usage: rrns_bench [--size BYTES] [--reps N] [--file PATH | --archive PATH]
+ *
+ */
+
+#include "helpers.h"
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVETSC true
+#else
+#define HAVETSC false
+#endif
+
+// Redundant moduli of the bases, as in main.cpp
+const size_t REDUNDANT = 4;
+
+/**
+ * @brief Best wall time and reference (TSC) cycles of a kernel
+ */
+struct Timing {
+  double seconds = 0;
+  double cycles = 0;
+};
+
+static inline uint64_t cycles () {
+#if HAVETSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief It runs the kernel reps times, keeping the fastest run
+ *
+ * @tparam F
+ * @param kernel
+ * @param reps
+ * @return Timing
+ */
+template <typename F>
+Timing measure (F kernel, int reps) {
+  Timing best;
+
+  for (int r = 0; r < reps; r++) {
+    auto begin = chrono::steady_clock::now();
+    uint64_t c0 = cycles();
+    kernel();
+    uint64_t c1 = cycles();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    if (r == 0 || seconds < best.seconds) {
+      best.seconds = seconds;
+      best.cycles = (double) (c1 - c0);
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief It prints the throughput of a kernel over a byte stream
+ *
+ * @param kernel
+ * @param moduli
+ * @param width
+ * @param bytes
+ * @param t
+ */
+void reportBytes (const char *kernel, size_t moduli, int width, size_t bytes,
+                  Timing t) {
+  printf("{\"kernel\": \"%s\", \"moduli\": %zu, \"width\": %d, \"bytes\": %zu, "
+         "\"ns_per_byte\": %.4f, ", kernel, moduli, width, bytes,
+         t.seconds * 1e9 / bytes);
+  if (HAVETSC && t.cycles > 0) {
+    printf("\"bytes_per_cycle\": %.4f}\n", bytes / t.cycles);
+  }
+  else {
+    printf("\"bytes_per_cycle\": null}\n");
+  }
+}
+
+/**
+ * @brief It prints the cost of a single call of a kernel
+ *
+ * @param kernel
+ * @param moduli
+ * @param ops Number of calls in the measured run
+ * @param t
+ */
+void reportOps (const char *kernel, size_t moduli, size_t ops, Timing t) {
+  printf("{\"kernel\": \"%s\", \"moduli\": %zu, \"ops\": %zu, \"ns_per_op\": %.2f, ",
+         kernel, moduli, ops, t.seconds * 1e9 / ops);
+  if (HAVETSC && t.cycles > 0) {
+    printf("\"cycles_per_op\": %.2f}\n", t.cycles / ops);
+  }
+  else {
+    printf("\"cycles_per_op\": null}\n");
+  }
+}
+
+/**
+ * @brief A base of the benchmark: low and high give the range of primes
+ * of RNSBase, otherwise it is the RNSSymbolBase of width
+ */
+struct Variant {
+  int low;
+  int high;
+  int width;
+};
+
+/**
+ * @brief Number of legitimate moduli: as in main.cpp all but the redundant
+ * ones, though at least as many as needed to cover a symbol
+ *
+ * @param base
+ * @param width
+ * @return size_t
+ */
+size_t legitimateModuli (const vector<int> &base, int width) {
+  size_t k = 0;
+  for (double range = 1; range < ldexp(1.0, 8 * width); k++) {
+    range *= base[k];
+  }
+  return max(k, base.size() - REDUNDANT);
+}
+
+/**
+ * @brief It runs all the kernels over the stream with one base
+ *
+ * @param v
+ * @param data
+ * @param reps
+ * @return true
+ * @return false If a kernel does not give back the stream
+ */
+bool benchVariant (const Variant &v, const vector<uint8_t> &data, int reps) {
+  vector<int> base = v.width == 1 ? RNSBase(v.low, v.high)
+                                  : RNSSymbolBase(v.width, REDUNDANT);
+  size_t n = base.size();
+  size_t legitimate = legitimateModuli(base, v.width);
+  vector<int> primary(base.begin(), base.begin() + legitimate);
+
+  size_t len = data.size();
+  size_t symbols = RNSSymbols(len, v.width);
+  vector<uint32_t> recip = RNSReciprocals(base);
+  vector<uint8_t> residues(symbols * n);
+  vector<uint8_t> out(len);
+
+  // Construction of the base
+  if (v.width == 1) {
+    const int calls = 1000;
+    reportOps("RNSBase", n, calls, measure([&]() {
+      for (int i = 0; i < calls; i++) {
+        if (RNSBase(v.low, v.high).size() != n) abort();
+      }
+    }, reps));
+  }
+
+  // Modular inverses of the CRT coefficients
+  const int rounds = 1000;
+  volatile int sink = 0;
+  reportOps("inv", n, rounds * legitimate, measure([&]() {
+    for (int r = 0; r < rounds; r++) {
+      for (size_t i = 0; i < legitimate; i++) {
+        int m = primary[i];
+        int64_t Mi = 1;
+        for (size_t j = 0; j < legitimate; j++) {
+          if (j != i) Mi = Mi * primary[j] % m;
+        }
+        sink = sink + inv((int) Mi, m);
+      }
+    }
+  }, reps));
+
+  // Scalar encoding, one byte at a time
+  if (v.width == 1) {
+    reportBytes("RNS", n, v.width, len, measure([&]() {
+      for (size_t i = 0; i < len; i++) {
+        vector<int> r = RNS(data[i], base);
+        for (size_t j = 0; j < n; j++) {
+          residues[j * symbols + i] = (uint8_t) r[j];
+        }
+      }
+    }, reps));
+  }
+
+  reportBytes("RNSEncodeBatch", n, v.width, len, measure([&]() {
+    RNSEncodeBatch(data.data(), len, v.width, base, recip, residues.data());
+  }, reps));
+
+  // Scalar decoding, one symbol at a time
+  if (v.width == 1) {
+    reportBytes("CRT", legitimate, v.width, len, measure([&]() {
+      vector<int> rem(legitimate);
+      for (size_t i = 0; i < len; i++) {
+        for (size_t j = 0; j < legitimate; j++) {
+          rem[j] = residues[j * symbols + i];
+        }
+        out[i] = (uint8_t) CRT(primary, rem);
+      }
+    }, reps));
+    if (out != data) {
+      cerr << "CRT does not give back the stream" << endl;
+      return false;
+    }
+  }
+
+  // Wire format of the residues
+  vector<uint8_t> packed;
+  reportBytes("RRNSPack", n, v.width, len, measure([&]() {
+    RRNSPack(base, v.width, residues.data(), len, packed);
+  }, reps));
+
+  vector<int> unpackedBase;
+  vector<uint8_t> unpacked;
+  int unpackedWidth;
+  size_t unpackedLen;
+  bool valid = true;
+  reportBytes("RRNSUnpack", n, v.width, len, measure([&]() {
+    valid = RRNSUnpack(packed.data(), packed.size(), unpackedBase, unpackedWidth, 
+                       unpackedLen, unpacked);
+  }, reps));
+  if (!valid || unpacked != residues) {
+    cerr << "RRNSUnpack does not give back the residues" << endl;
+    return false;
+  }
+
+  CRTTable table = CRTPrecompute(primary);
+  reportBytes("CRTDecodeBatch", legitimate, v.width, len, measure([&]() {
+    CRTDecodeBatch(table, residues.data(), len, v.width, out.data());
+  }, reps));
+  if (out != data) {
+    cerr << "CRTDecodeBatch does not give back the stream" << endl;
+    return false;
+  }
+
+  // Plain CRT over all the moduli, the cost of an error-free RRNS decoding
+  CRTTable full = CRTPrecompute(base);
+  reportBytes("CRTDecodeBatch-full", n, v.width, len, measure([&]() {
+    CRTDecodeBatch(full, residues.data(), len, v.width, out.data());
+  }, reps));
+  if (out != data) {
+    cerr << "CRTDecodeBatch does not give back the stream over the whole base" << endl;
+    return false;
+  }
+
+  RRNSDecoder decoder = RRNSPrecompute(base, legitimate, v.width);
+  RRNSStats stats;
+  reportBytes("RRNSDecodeBatch", n, v.width, len, measure([&]() {
+    RRNSDecodeBatch(decoder, residues.data(), len, 0, out.data(), stats);
+  }, reps));
+  if (out != data) {
+    cerr << "RRNSDecodeBatch does not give back the stream" << endl;
+    return false;
+  }
+
+  // The first n - k planes are lost, so any legitimate k of the n decode
+  vector<uint8_t> erased(residues);
+  uint32_t missing = 0;
+  for (size_t j = 0; j < n - legitimate; j++) {
+    missing |= UINT32_C(1) << j;
+    fill(erased.begin() + j * symbols, erased.begin() + (j + 1) * symbols, 0);
+  }
+  reportBytes("RRNSDecodeBatch-erasure", n, v.width, len, measure([&]() {
+    RRNSDecodeBatch(decoder, erased.data(), len, missing, out.data(), stats);
+  }, reps));
+  if (out != data) {
+    cerr << "RRNSDecodeBatch does not recover the stream without "
+         << n - legitimate << " residues" << endl;
+    return false;
+  }
+
+  // One faulty residue in 1% of the symbols, to drive the correction path
+  mt19937 gen(1);
+  for (size_t i = 0; i < symbols; i += 100) {
+    size_t j = gen() % n;
+    residues[j * symbols + i] = (uint8_t) ((residues[j * symbols + i] + 1) % base[j]);
+  }
+
+  if (n - legitimate >= 2) {
+    reportBytes("RRNSDecodeBatch-faulty", n, v.width, len, measure([&]() {
+      RRNSDecodeBatch(decoder, residues.data(), len, 0, out.data(), stats);
+    }, reps));
+    if (out != data) {
+      cerr << "RRNSDecodeBatch does not correct the stream" << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char *argv[]) {
+  size_t size = 1 << 20;
+  int reps = 20;
+  string file;
+  string archive;
+
+  for (int a = 1; a < argc; a++) {
+    string arg = argv[a];
+
+    if (arg == "--size" && a + 1 < argc) {
+      size = max(1L, atol(argv[++a]));
+    }
+    else if (arg == "--reps" && a + 1 < argc) {
+      reps = max(1, atoi(argv[++a]));
+    }
+    else if (arg == "--file" && a + 1 < argc) {
+      file = argv[++a];
+    }
+    else if (arg == "--archive" && a + 1 < argc) {
+      archive = argv[++a];
+    }
+    else {
+      cerr << "Usage: " << argv[0] 
+           << " [--size BYTES] [--reps N] [--file PATH | --archive PATH]" << endl;
+      return 1;
+    }
+  }
+
+  /* The stream is a serialised cipher if given, as a file or as the first 
+   * record of an archive, otherwise uniform random bytes, which is what 
+   * the serialised ciphers look like
+   */
+  vector<uint8_t> data;
+  if (!archive.empty()) {
+    ArchiveReader ciphers(archive);
+    const uint8_t *record;
+    size_t len;
+    if (!ciphers.good() || !ciphers.get(0, record, len) || len == 0) return 1;
+    data.assign(record, record + len);
+  }
+  else if (!file.empty()) {
+    MappedFile mapped(file);
+    if (!mapped.good() || mapped.size() == 0) return 1;
+    data.assign(mapped.data(), mapped.data() + mapped.size());
+  }
+  else {
+    mt19937 gen(0);
+    data.resize(size);
+    for (auto &b : data) b = (uint8_t) gen();
+  }
+
+  // The 8, 12 and 14 moduli bases of main.cpp, then the 2-byte symbols
+  const vector<Variant> variants = {{0, 20, 1}, {0, 40, 1}, {0, 45, 1}, {0, 0, 2}};
+
+  for (const Variant &v : variants) {
+    if (!benchVariant(v, data, reps)) return 1;
+  }
+  return 0;
+}
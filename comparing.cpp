@@ -3,69 +3,483 @@
  * @author Chiara Boni
  * @brief This script allows one to take two input files and compare their contents.
  * It was used to demonstrate that calculations with and without RNS encoding are equivalent.
- * 
- * @version 0.1
- * 
+ *
+ * Both files are mapped in memory and compared in blocks on all the cores;
+ * the first difference is reported with its offset and line. Two directories,
+ * such as the results of repeated runs, are compared file by file in parallel.
+ * In hash mode only a digest of every file is printed, or checked against a
+ * list of digests, so that large outputs can be verified without both copies.
+ *
+ * Build: g++ -O3 -fopenmp comparing.cpp -o comparing
+ *
+ * Usage: comparing [--threads N] [FILE1 FILE2 | DIR1 DIR2]
+ *        comparing [--threads N] --hash PATH...
+ *        comparing [--threads N] --check DIGESTS
+ *
+ * @version 0.2
+ *
  * @copyright Copyright (c) 2022
- * 
+ *
  */
 
 #include <bits/stdc++.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
 using namespace std;
 
+// Bytes compared or hashed by a thread at a time
+const size_t BLOCK = 1 << 20;
+
+int num_threads = omp_get_max_threads();
+
+/**
+ * @brief Read-only memory mapping of a whole file
+ */
+class Mapping {
+public:
+    Mapping (const string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            length = st.st_size;
+            valid = true;
+            if (length > 0) {
+                void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    valid = false;
+                }
+                else {
+                    bytes = (const uint8_t*) p;
+                    madvise(p, length, MADV_SEQUENTIAL);
+                }
+            }
+        }
+        close(fd);
+    }
+
+    ~Mapping () {
+        if (bytes != nullptr) munmap((void*) bytes, length);
+    }
+
+    Mapping (const Mapping&) = delete;
+    Mapping& operator= (const Mapping&) = delete;
+
+    bool good () const { return valid; }
+    const uint8_t* data () const { return bytes; }
+    size_t size () const { return length; }
+
+private:
+    const uint8_t *bytes = nullptr;
+    size_t length = 0;
+    bool valid = false;
+};
+
+/**
+ * @brief Outcome of the comparison of two files
+ */
+struct Comparison {
+    bool readable = true;
+    bool equal = true;
+    size_t offset = 0;      // first differing byte
+    size_t line = 0;        // its line, from 1
+    size_t column = 0;      // its column, from 1
+};
+
+/**
+ * @brief Offset of the first differing byte in the common prefix of two
+ * buffers: the blocks are compared with memcmp on threads threads, and
+ * only the first differing one is scanned byte by byte
+ *
+ * @param a
+ * @param b
+ * @param len
+ * @param threads
+ * @return size_t len if they are equal
+ */
+size_t first_difference(const uint8_t *a, const uint8_t *b, size_t len, int threads) {
+    size_t blocks = (len + BLOCK - 1) / BLOCK;
+    size_t first = blocks;
+
+    #pragma omp parallel for num_threads(threads) schedule(static) reduction(min:first)
+    for (size_t k = 0; k < blocks; k++) {
+        // A block after a known difference cannot be the first one
+        if (k > first) continue;
+        size_t begin = k * BLOCK;
+        size_t n = min(BLOCK, len - begin);
+        if (memcmp(a + begin, b + begin, n) != 0) first = k;
+    }
+
+    if (first == blocks) return len;
+
+    size_t i = first * BLOCK;
+    while (a[i] == b[i]) i++;
+    return i;
+}
+
+/**
+ * @brief Line and column of a byte, counting the newlines before it in parallel
+ *
+ * @param data
+ * @param offset
+ * @param threads
+ * @param result
+ */
+void locate(const uint8_t *data, size_t offset, int threads, Comparison& result) {
+    size_t lines = 0;
+
+    #pragma omp parallel for num_threads(threads) schedule(static) reduction(+:lines)
+    for (size_t begin = 0; begin < offset; begin += BLOCK) {
+        const uint8_t *p = data + begin;
+        lines += count(p, p + min(BLOCK, offset - begin), '\n');
+    }
+
+    size_t start = offset;
+    while (start > 0 && data[start - 1] != '\n') start--;
+
+    result.line = lines + 1;
+    result.column = offset - start + 1;
+}
+
+/**
+ * @brief Maps the two files and compares them
+ *
+ * @param filename1
+ * @param filename2
+ * @param threads
+ * @return Comparison
+ */
+Comparison compare_files(const string& filename1, const string& filename2, int threads) {
+    Comparison result;
+    Mapping file1(filename1);
+    Mapping file2(filename2);
+
+    if (!file1.good() || !file2.good()) {
+        cerr << "Could not read " << (file1.good() ? filename2 : filename1) << endl;
+        result.readable = false;
+        return result;
+    }
+
+    size_t common = min(file1.size(), file2.size());
+    result.offset = first_difference(file1.data(), file2.data(), common, threads);
+    result.equal = result.offset == common && file1.size() == file2.size();
+
+    if (!result.equal) {
+        // Past the end of the shorter file, the position is located in the longer one
+        const Mapping& longer = file1.size() >= file2.size() ? file1 : file2;
+        locate(longer.data(), result.offset, threads, result);
+    }
+    return result;
+}
+
+/**
+ * @brief Regular files of a directory, sorted by name
+ *
+ * @param dirname
+ * @param names
+ * @return true
+ * @return false If the directory cannot be read
+ */
+bool list_files(const string& dirname, vector<string>& names) {
+    DIR *dir = opendir(dirname.c_str());
+    if (dir == nullptr) return false;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        struct stat st;
+        string name = entry->d_name;
+        if (stat((dirname + "/" + name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    sort(names.begin(), names.end());
+    return true;
+}
+
+bool is_directory(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Prints the outcome of a comparison
+ *
+ * @param name
+ * @param result
+ */
+void report(const string& name, const Comparison& result) {
+    if (!result.readable) {
+        cout << name << ": unreadable\n";
+    }
+    else if (result.equal) {
+        cout << name << ": equal\n";
+    }
+    else {
+        cout << name << ": differ at byte " << result.offset << ", line "
+             << result.line << ", column " << result.column << "\n";
+    }
+}
+
+/**
+ * @brief Compares the files with the same name in the two directories,
+ * one file per thread; a file missing on either side is a difference
+ *
+ * @param dir1
+ * @param dir2
+ * @return int Exit code: 0 if all are equal, 1 if some differ, 2 on errors
+ */
+int compare_directories(const string& dir1, const string& dir2) {
+    vector<string> names1, names2, names;
+    if (!list_files(dir1, names1) || !list_files(dir2, names2)) {
+        cerr << "Could not read the directories" << endl;
+        return 2;
+    }
+    set_union(names1.begin(), names1.end(), names2.begin(), names2.end(),
+              back_inserter(names));
+
+    vector<Comparison> results(names.size());
+
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (size_t i = 0; i < names.size(); i++) {
+        if (binary_search(names1.begin(), names1.end(), names[i]) &&
+            binary_search(names2.begin(), names2.end(), names[i])) {
+            results[i] = compare_files(dir1 + "/" + names[i], dir2 + "/" + names[i], 1);
+        }
+    }
+
+    size_t different = 0;
+    bool unreadable = false;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!binary_search(names2.begin(), names2.end(), names[i])) {
+            cout << names[i] << ": only in " << dir1 << "\n";
+            different++;
+        }
+        else if (!binary_search(names1.begin(), names1.end(), names[i])) {
+            cout << names[i] << ": only in " << dir2 << "\n";
+            different++;
+        }
+        else if (!results[i].equal || !results[i].readable) {
+            report(names[i], results[i]);
+            different++;
+        }
+        unreadable = unreadable || !results[i].readable;
+    }
+
+    cout << names.size() - different << " of " << names.size() << " files are equal\n";
+    if (unreadable) return 2;
+    return different == 0 ? 0 : 1;
+}
+
+/**
+ * @brief 64-bit hash of a block, eight bytes at a time. It detects
+ * accidental differences, it is not a cryptographic digest.
+ *
+ * @param p
+ * @param n
+ * @return uint64_t
+ */
+uint64_t hash_block(const uint8_t *p, size_t n) {
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t h = 0xcbf29ce484222325ULL ^ n;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w *= 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (w ^ (w >> 32))) * prime;
+    }
+    for (; i < n; i++) {
+        h = (h ^ p[i]) * prime;
+    }
+    return h ^ (h >> 29);
+}
+
+/**
+ * @brief Digest of a file: the blocks are hashed in parallel, then their
+ * hashes are hashed in order
+ *
+ * @param filename
+ * @param threads
+ * @param digest Hexadecimal digest
+ * @return true
+ * @return false If the file cannot be read
+ */
+bool hash_file(const string& filename, int threads, string& digest) {
+    Mapping file(filename);
+    if (!file.good()) {
+        cerr << "Could not read " << filename << endl;
+        return false;
+    }
+
+    size_t blocks = (file.size() + BLOCK - 1) / BLOCK;
+    vector<uint64_t> hashes(blocks + 1, file.size());
+
+    #pragma omp parallel for num_threads(threads) schedule(static)
+    for (size_t k = 0; k < blocks; k++) {
+        size_t begin = k * BLOCK;
+        hashes[k] = hash_block(file.data() + begin, min(BLOCK, file.size() - begin));
+    }
+
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)
+             hash_block((const uint8_t*) hashes.data(), hashes.size() * sizeof(uint64_t)));
+    digest = hex;
+    return true;
+}
+
 /**
- * @brief Browses the contents of files using iterators
- * 
- * @param first1 
- * @param last1 
- * @param first2 
- * @param last2 
- * @return true 
- * @return false 
+ * @brief Prints the digest of every file, and of every file of the
+ * directories, one per line followed by its path
+ *
+ * @param paths
+ * @return int Exit code
  */
-template<typename InputIterator1, typename InputIterator2>
-bool range_equal(InputIterator1 first1, InputIterator1 last1,
-        InputIterator2 first2, InputIterator2 last2) {
+int hash_paths(const vector<string>& paths) {
+    vector<string> files;
+    for (const string& path : paths) {
+        vector<string> names;
+        if (is_directory(path) && list_files(path, names)) {
+            for (const string& name : names) files.push_back(path + "/" + name);
+        }
+        else {
+            files.push_back(path);
+        }
+    }
+
+    vector<string> digests(files.size());
+    bool failed = false;
+    int outer = files.size() > 1 ? num_threads : 1;
+    int inner = files.size() > 1 ? 1 : num_threads;
+
+    #pragma omp parallel for num_threads(outer) schedule(dynamic)
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!hash_file(files[i], inner, digests[i])) {
+            #pragma omp atomic write
+            failed = true;
+        }
+    }
 
-    while(first1 != last1 && first2 != last2) {
-        if(*first1 != *first2) return false;
-        ++first1;
-        ++first2;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!digests[i].empty()) cout << digests[i] << "  " << files[i] << "\n";
     }
-    return (first1 == last1) && (first2 == last2);
+    return failed ? 2 : 0;
 }
 
 /**
- * @brief Converts the two files to iterators on char elements
- * 
- * @param filename1 
- * @param filename2 
- * @return true 
- * @return false 
+ * @brief Checks the files against a list of digests, as printed by --hash
+ *
+ * @param listname
+ * @return int Exit code: 0 if all match, 1 if some differ, 2 on errors
  */
-bool compare_files(const string& filename1, const string& filename2) {
-    ifstream file1(filename1);
-    ifstream file2(filename2);
+int check_digests(const string& listname) {
+    ifstream list(listname);
+    if (!list) {
+        cerr << "Could not read " << listname << endl;
+        return 2;
+    }
+
+    vector<string> expected, files;
+    string digest, file;
+    while (list >> digest && getline(list >> ws, file)) {
+        expected.push_back(digest);
+        files.push_back(file);
+    }
 
-    istreambuf_iterator<char> begin1(file1);
-    istreambuf_iterator<char> begin2(file2);
+    vector<string> digests(files.size());
 
-    istreambuf_iterator<char> end;
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (size_t i = 0; i < files.size(); i++) {
+        hash_file(files[i], 1, digests[i]);
+    }
+
+    size_t different = 0;
+    bool unreadable = false;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (digests[i] != expected[i]) {
+            cout << files[i] << ": " << (digests[i].empty() ? "unreadable" : "differs") << "\n";
+            different++;
+            unreadable = unreadable || digests[i].empty();
+        }
+    }
 
-    return range_equal(begin1, end, begin2, end);
+    cout << files.size() - different << " of " << files.size() << " files match\n";
+    if (unreadable) return 2;
+    return different == 0 ? 0 : 1;
 }
 
-int main () {
+int main (int argc, char *argv[]) {
 
     string test = "./Int_Scheme/build/test.txt";
     string test_rns = "./Int_Scheme/build/test_rns.txt";
 
-    if (compare_files(test, test_rns)) {
-        cout << "Files are equal\n";
+    vector<string> paths;
+    bool hash = false;
+    string check;
+
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+
+        if (arg == "--threads" && a + 1 < argc) {
+            num_threads = max(1, atoi(argv[++a]));
+        }
+        else if (arg == "--hash") {
+            hash = true;
+        }
+        else if (arg == "--check" && a + 1 < argc) {
+            check = argv[++a];
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            cerr << "Usage: " << argv[0] << " [--threads N] [FILE1 FILE2 | DIR1 DIR2]\n"
+                 << "       " << argv[0] << " [--threads N] --hash PATH...\n"
+                 << "       " << argv[0] << " [--threads N] --check DIGESTS" << endl;
+            return 2;
+        }
+        else {
+            paths.push_back(arg);
+        }
     }
-    else {
-        cout << "Files are NOT equal\n";
+
+    if (!check.empty()) {
+        return check_digests(check);
+    }
+
+    if (hash) {
+        return hash_paths(paths);
+    }
+
+    if (paths.size() == 2) {
+        test = paths[0];
+        test_rns = paths[1];
+    }
+    else if (!paths.empty()) {
+        cerr << "Two files or two directories are needed" << endl;
+        return 2;
+    }
+
+    if (is_directory(test) && is_directory(test_rns)) {
+        return compare_directories(test, test_rns);
+    }
+
+    Comparison result = compare_files(test, test_rns, num_threads);
+    if (!result.readable) {
+        return 2;
     }
 
-    return 0;
-}
\ No newline at end of file
+    if (result.equal) {
+        cout << "Files are equal\n";
+        return 0;
+    }
+
+    cout << "Files are NOT equal\n"
+         << "First difference at byte " << result.offset << ", line "
+         << result.line << ", column " << result.column << "\n";
+    return 1;
+}